@@ -0,0 +1,44 @@
+#ifndef STENCIL_KERNELS_HPP
+#define STENCIL_KERNELS_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+
+// Computes one row of a stencil sweep over elements of type T. src and tgt point to the start of the same row in the
+// source and target grids, whose rows are pitch elements apart. Points [first, last) of the row are updated. Residual
+// kernels also return the largest absolute change made to any point of the row, so that convergence checks get it out
+// of the sweep itself rather than a second pass over the grids. Other kernels return 0
+template <typename T>
+using row_kernel = double (*)(const T *src, T *tgt, size_t pitch, uint32_t first, uint32_t last);
+
+// Instruction sets the row kernels are built for, in order of preference
+enum simd_isa {scalar_isa = 0, sse2_isa = 1, avx2_isa = 2, avx512_isa = 3};
+
+extern char const *simd_isa_names[];
+
+// Stencils a run can use. The basic stencils update one point at a time, the SIMD stencils a row at a time with the
+// row kernels. Small stencils read each point's four neighbours, large ones its 5x5 neighbourhood
+enum stencil_kind {no_stencil = 0, basic_small_stencil = 1, basic_large_stencil = 2, simd_small_stencil = 3,
+                   simd_large_stencil = 4};
+
+// Element types the grids can hold
+enum element_precision {double_precision = 0, float_precision = 1};
+
+
+
+// Returns the widest instruction set supported by this cpu
+simd_isa detect_simd_isa();
+
+// Returns the row version of basic_kernel_small for elements of type T (float or double) and the given instruction
+// set. Same results as the point kernel
+template <typename T>
+row_kernel<T> select_small_row_kernel(simd_isa isa, bool residual);
+
+// Returns the row version of basic_kernel_large for elements of type T (float or double) and the given instruction
+// set. Same results as the point kernel
+template <typename T>
+row_kernel<T> select_large_row_kernel(simd_isa isa, bool residual);
+
+#endif // STENCIL_KERNELS_HPP
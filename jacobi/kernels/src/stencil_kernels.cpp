@@ -0,0 +1,320 @@
+#include "stencil_kernels.hpp"
+
+#include <string.h>
+
+
+
+// Printable names of each instruction set
+char const *simd_isa_names[] = {"scalar", "SSE2", "AVX2", "AVX-512"};
+
+
+
+// Stencils are written once against GCC vector types, and compiled once per instruction set by inlining them into
+// wrappers built for that target. Each lane adds its neighbours in the same order as the point kernels, so every
+// version gives bit-identical results
+
+// Vectors of 2, 4 and 8 doubles, and 4, 8 and 16 floats
+typedef double v2d __attribute__((vector_size(16)));
+typedef double v4d __attribute__((vector_size(32)));
+typedef double v8d __attribute__((vector_size(64)));
+
+typedef float v4f  __attribute__((vector_size(16)));
+typedef float v8f  __attribute__((vector_size(32)));
+typedef float v16f __attribute__((vector_size(64)));
+
+// Vector of T for each instruction set
+template <typename T>
+struct vectors;
+
+template <>
+struct vectors<double> {
+	typedef v2d sse2;
+	typedef v4d avx2;
+	typedef v8d avx512;
+};
+
+template <>
+struct vectors<float> {
+	typedef v4f  sse2;
+	typedef v8f  avx2;
+	typedef v16f avx512;
+};
+
+#define FORCE_INLINE inline __attribute__((always_inline))
+
+// Load and store a vector of type V at any address in a row. Written as macros, as vectors passed to or returned from
+// functions built for a narrower target change the ABI
+#define load(p)      ({ V v_; memcpy(&v_, (p), sizeof(V)); v_; })
+#define store(p, v)  ({ V v_ = (v); memcpy((p), &v_, sizeof(V)); })
+
+// Folds the absolute change from old to updated into the running maximum m
+#define track(m, updated, old)  ({ V d_ = (updated) - (old); d_ = d_ < 0 ? -d_ : d_; m = m > d_ ? m : d_; })
+
+// Returns the largest lane of m
+template <typename T, typename V, uint32_t W>
+static FORCE_INLINE double max_lane(const V &m) {
+
+	T lanes[W];
+	memcpy(lanes, &m, sizeof(V));
+
+	T max = lanes[0];
+
+	for (uint32_t k = 1; k < W; k++) {
+		max = max > lanes[k] ? max : lanes[k];
+	}
+
+	return max;
+}
+
+
+
+// Four point stencil over a row of T, W points at a time in vectors V, finishing off with single points. With R, also
+// returns the largest absolute change made to any point
+template <typename T, typename V, uint32_t W, bool R>
+static FORCE_INLINE double small_row(const T *src, T *tgt, size_t pitch, uint32_t first, uint32_t last) {
+
+	const T *up   = src - pitch;
+	const T *down = src + pitch;
+
+	V      m = {};
+	double r = 0.0;
+
+	uint32_t j = first;
+
+	for (; j + W <= last; j += W) {
+		V sum = load(up + j) + load(down + j) + load(src + j - 1) + load(src + j + 1);
+
+		store(tgt + j, sum * (T) 0.25);
+
+		if (R) {
+			track(m, sum * (T) 0.25, load(src + j));
+		}
+	}
+
+	for (; j < last; j++) {
+		tgt[j] = (up[j] + down[j] + src[j - 1] + src[j + 1]) * (T) 0.25;
+
+		if (R) {
+			double d = tgt[j] > src[j] ? tgt[j] - src[j] : src[j] - tgt[j];
+			r = r > d ? r : d;
+		}
+	}
+
+	if (R) {
+		double v = max_lane<T, V, W>(m);
+		r = r > v ? r : v;
+	}
+
+	return r;
+}
+
+// 5x5 stencil over a row of T, W points at a time in vectors V, finishing off with single points. With R, also returns
+// the largest absolute change made to any point
+template <typename T, typename V, uint32_t W, bool R>
+static FORCE_INLINE double large_row(const T *src, T *tgt, size_t pitch, uint32_t first, uint32_t last) {
+
+	const T *r0 = src - 2 * pitch;
+	const T *r1 = src - pitch;
+	const T *r2 = src;
+	const T *r3 = src + pitch;
+	const T *r4 = src + 2 * pitch;
+
+	V      m = {};
+	double r = 0.0;
+
+	uint32_t j = first;
+
+	for (; j + W <= last; j += W) {
+		V t;
+
+		t  = (load(r0 + j + 2) + load(r1 + j + 2) + load(r2 + j + 2) + load(r3 + j + 2) + load(r4 + j + 2));
+		t += (load(r0 + j + 1) + load(r1 + j + 1) + load(r2 + j + 1) + load(r3 + j + 1) + load(r4 + j + 1));
+		t += (load(r0 + j)     + load(r1 + j)                           + load(r3 + j)     + load(r4 + j));
+		t += (load(r0 + j - 1) + load(r1 + j - 1) + load(r2 + j - 1) + load(r3 + j - 1) + load(r4 + j - 1));
+		t += (load(r0 + j - 2) + load(r1 + j - 2) + load(r2 + j - 2) + load(r3 + j - 2) + load(r4 + j - 2));
+
+		store(tgt + j, t / (T) 24);
+
+		if (R) {
+			track(m, t / (T) 24, load(r2 + j));
+		}
+	}
+
+	for (; j < last; j++) {
+		T t;
+
+		t  = (r0[j + 2] + r1[j + 2] + r2[j + 2] + r3[j + 2] + r4[j + 2]);
+		t += (r0[j + 1] + r1[j + 1] + r2[j + 1] + r3[j + 1] + r4[j + 1]);
+		t += (r0[j]     + r1[j]                 + r3[j]     + r4[j]);
+		t += (r0[j - 1] + r1[j - 1] + r2[j - 1] + r3[j - 1] + r4[j - 1]);
+		t += (r0[j - 2] + r1[j - 2] + r2[j - 2] + r3[j - 2] + r4[j - 2]);
+
+		tgt[j] = t / (T) 24;
+
+		if (R) {
+			double d = tgt[j] > r2[j] ? tgt[j] - r2[j] : r2[j] - tgt[j];
+			r = r > d ? r : d;
+		}
+	}
+
+	if (R) {
+		double v = max_lane<T, V, W>(m);
+		r = r > v ? r : v;
+	}
+
+	return r;
+}
+
+
+
+// Per instruction set versions, for each element type T and with or without the residual. The scalar versions are
+// kept from being auto-vectorized, as a baseline
+
+#define LANES(V) (sizeof(V) / sizeof(T))
+
+template <typename T, bool R>
+__attribute__((optimize("no-tree-vectorize")))
+static double small_row_scalar(const T *src, T *tgt, size_t pitch, uint32_t first, uint32_t last) {
+
+	return small_row<T, T, 1, R>(src, tgt, pitch, first, last);
+}
+
+template <typename T, bool R>
+static double small_row_sse2(const T *src, T *tgt, size_t pitch, uint32_t first, uint32_t last) {
+
+	typedef typename vectors<T>::sse2 V;
+
+	return small_row<T, V, LANES(V), R>(src, tgt, pitch, first, last);
+}
+
+template <typename T, bool R>
+__attribute__((target("avx2")))
+static double small_row_avx2(const T *src, T *tgt, size_t pitch, uint32_t first, uint32_t last) {
+
+	typedef typename vectors<T>::avx2 V;
+
+	return small_row<T, V, LANES(V), R>(src, tgt, pitch, first, last);
+}
+
+template <typename T, bool R>
+__attribute__((target("avx512f")))
+static double small_row_avx512(const T *src, T *tgt, size_t pitch, uint32_t first, uint32_t last) {
+
+	typedef typename vectors<T>::avx512 V;
+
+	return small_row<T, V, LANES(V), R>(src, tgt, pitch, first, last);
+}
+
+template <typename T, bool R>
+__attribute__((optimize("no-tree-vectorize")))
+static double large_row_scalar(const T *src, T *tgt, size_t pitch, uint32_t first, uint32_t last) {
+
+	return large_row<T, T, 1, R>(src, tgt, pitch, first, last);
+}
+
+template <typename T, bool R>
+static double large_row_sse2(const T *src, T *tgt, size_t pitch, uint32_t first, uint32_t last) {
+
+	typedef typename vectors<T>::sse2 V;
+
+	return large_row<T, V, LANES(V), R>(src, tgt, pitch, first, last);
+}
+
+template <typename T, bool R>
+__attribute__((target("avx2")))
+static double large_row_avx2(const T *src, T *tgt, size_t pitch, uint32_t first, uint32_t last) {
+
+	typedef typename vectors<T>::avx2 V;
+
+	return large_row<T, V, LANES(V), R>(src, tgt, pitch, first, last);
+}
+
+template <typename T, bool R>
+__attribute__((target("avx512f")))
+static double large_row_avx512(const T *src, T *tgt, size_t pitch, uint32_t first, uint32_t last) {
+
+	typedef typename vectors<T>::avx512 V;
+
+	return large_row<T, V, LANES(V), R>(src, tgt, pitch, first, last);
+}
+
+
+
+// Returns the version of the small row kernel for the given instruction set
+template <typename T, bool R>
+static row_kernel<T> small_row_kernel(simd_isa isa) {
+
+	switch (isa) {
+		case avx512_isa:
+			return small_row_avx512<T, R>;
+
+		case avx2_isa:
+			return small_row_avx2<T, R>;
+
+		case sse2_isa:
+			return small_row_sse2<T, R>;
+
+		default:
+			return small_row_scalar<T, R>;
+	}
+}
+
+// Returns the version of the large row kernel for the given instruction set
+template <typename T, bool R>
+static row_kernel<T> large_row_kernel(simd_isa isa) {
+
+	switch (isa) {
+		case avx512_isa:
+			return large_row_avx512<T, R>;
+
+		case avx2_isa:
+			return large_row_avx2<T, R>;
+
+		case sse2_isa:
+			return large_row_sse2<T, R>;
+
+		default:
+			return large_row_scalar<T, R>;
+	}
+}
+
+
+
+// Returns the widest instruction set supported by this cpu
+simd_isa detect_simd_isa() {
+
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f")) {
+		return avx512_isa;
+	}
+
+	if (__builtin_cpu_supports("avx2")) {
+		return avx2_isa;
+	}
+
+	if (__builtin_cpu_supports("sse2")) {
+		return sse2_isa;
+	}
+
+	return scalar_isa;
+}
+
+// Returns the row version of basic_kernel_small for elements of type T and the given instruction set
+template <typename T>
+row_kernel<T> select_small_row_kernel(simd_isa isa, bool residual) {
+
+	return residual ? small_row_kernel<T, true>(isa) : small_row_kernel<T, false>(isa);
+}
+
+// Returns the row version of basic_kernel_large for elements of type T and the given instruction set
+template <typename T>
+row_kernel<T> select_large_row_kernel(simd_isa isa, bool residual) {
+
+	return residual ? large_row_kernel<T, true>(isa) : large_row_kernel<T, false>(isa);
+}
+
+template row_kernel<double> select_small_row_kernel<double>(simd_isa isa, bool residual);
+template row_kernel<float>  select_small_row_kernel<float>(simd_isa isa, bool residual);
+template row_kernel<double> select_large_row_kernel<double>(simd_isa isa, bool residual);
+template row_kernel<float>  select_large_row_kernel<float>(simd_isa isa, bool residual);
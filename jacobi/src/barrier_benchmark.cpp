@@ -0,0 +1,106 @@
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <stdlib.h>
+
+#include <general_utils.hpp>
+#include <barriers.hpp>
+
+
+
+// Default number of barrier episodes timed for each type and thread count
+#define DEFAULT_EPISODES 100000
+
+// Times num_episodes back to back waits on a barrier of the given type, and returns the mean time per episode in ns
+double time_barrier(barrier_type type, uint32_t num_threads, uint32_t num_episodes, uint32_t spin);
+
+
+
+std::string randomised_seed;
+
+
+
+// Usage: barrier_benchmark [max_threads] [num_episodes] [spin]. Times every barrier type at 1, 2, 4, ... max_threads
+// threads, each thread pinned to its own core where there are enough
+int main(int argc, char *argv[]) {
+
+	uint32_t max_threads  = argc > 1 ? atoi(argv[1]) : std::thread::hardware_concurrency();
+	uint32_t num_episodes = argc > 2 ? atoi(argv[2]) : DEFAULT_EPISODES;
+	uint32_t spin         = argc > 3 ? atoi(argv[3]) : DEFAULT_BARRIER_SPIN;
+
+	std::vector<uint32_t> thread_counts;
+
+	for (uint32_t n = 1; n < max_threads; n *= 2) {
+		thread_counts.push_back(n);
+	}
+
+	thread_counts.push_back(std::max(max_threads, 1u));
+
+	print("Barrier episode times (ns), ", num_episodes, " episodes, spin ", spin, "\n\nthreads");
+
+	for (uint32_t t = 0; t < NUM_BARRIER_TYPES; t++) {
+		print("\t", barrier_names[t]);
+	}
+
+	print("\n");
+
+	for (uint32_t n : thread_counts) {
+		print(n);
+
+		for (uint32_t t = 0; t < NUM_BARRIER_TYPES; t++) {
+			print("\t", (uint64_t) time_barrier((barrier_type) t, n, num_episodes, spin));
+		}
+
+		print("\n");
+	}
+
+	return 0;
+}
+
+
+
+// Times num_episodes back to back waits on a barrier of the given type, and returns the mean time per episode in ns
+double time_barrier(barrier_type type, uint32_t num_threads, uint32_t num_episodes, uint32_t spin) {
+
+	std::unique_ptr<Barrier> barrier = make_barrier(type, num_threads, spin);
+
+	uint32_t num_cores = std::thread::hardware_concurrency();
+
+	std::chrono::high_resolution_clock::time_point start, end;
+
+	auto body = [&](uint32_t id) {
+
+		if (num_threads <= num_cores) {
+			force_affinity_set(std::vector<uint32_t>(1, id));
+		}
+
+		// Line everyone up before the clock starts
+		barrier->wait(id);
+
+		if (id == 0) {
+			start = std::chrono::high_resolution_clock::now();
+		}
+
+		for (uint32_t i = 0; i < num_episodes; i++) {
+			barrier->wait(id);
+		}
+
+		if (id == 0) {
+			end = std::chrono::high_resolution_clock::now();
+		}
+	};
+
+	std::vector<std::thread> threads;
+
+	for (uint32_t id = 1; id < num_threads; id++) {
+		threads.push_back(std::thread(body, id));
+	}
+
+	body(0);
+
+	for (auto& t : threads) {
+		t.join();
+	}
+
+	return std::chrono::duration<double, std::nano>(end - start).count() / num_episodes;
+}
@@ -1,12 +1,21 @@
 #include <thread>
 #include <vector>
 #include <map>
+#include <atomic>
+#include <cmath>
+#include <sched.h>
 #include <sys/times.h>
 #include <algorithm>
+#include <numeric>
 
 #include <general_utils.hpp>
 #include <config_file_utils.hpp>
+#include <barriers.hpp>
+#include <worker_team.hpp>
+#include <tile_scheduler.hpp>
 #include <kernels.hpp>
+#include <stencil_kernels.hpp>
+#include <grid.hpp>
 
 
 
@@ -17,34 +26,6 @@
 #define SCP( x )
 #endif
 
-#ifdef MY_BARRIER
-#define MB( x ) x
-#pragma message "MY_BARRIER ACTIVE"
-#else
-#define MB( x )
-#endif
-
-#ifdef PTHREAD_BARRIER
-#define PTB( x ) x
-#pragma message "PTHREAD_BARRIER ACTIVE"
-#else
-#define PTB( x )
-#endif
-
-#ifdef BASIC_KERNEL_SMALL
-#define BKS( x ) x
-#pragma message "BASIC_KERNEL_SMALL ACTIVE"
-#else
-#define BKS( x )
-#endif
-
-#ifdef BASIC_KERNEL_LARGE
-#define BKL( x ) x
-#pragma message "BASIC_KERNEL_LARGE ACTIVE"
-#else
-#define BKL( x )
-#endif
-
 #ifdef VARY_KERNEL_LOAD
 #define VRY( x ) x
 #pragma message "VARY_KERNEL_LOAD ACTIVE"
@@ -68,64 +49,174 @@
 
 
 
-// Each Worker computes values in one strip of the grids. The main worker loop does two computations to avoid copying from one grid to the other
+// Each Worker computes values in one strip of the grids. The main worker loop does two computations to avoid copying from one grid to the other.
+// Run by the persistent worker team, once per stage, on grids of T with stencil S
+template <typename T, stencil_kind S>
 void worker(uint32_t my_id, uint32_t stage);
 
-// Initialize the grids (grid1 and grid2), set boundaries to 1.0 and interior points to 0.0
-void initialize_grids();
+// Worker loop of a stage, instantiated for one element type and stencil
+typedef void (*stage_job)(uint32_t my_id, uint32_t stage);
+
+// Returns the worker loop for grids of T and the given stencil
+template <typename T>
+stage_job select_worker(stencil_kind stencil);
+
+// Temporally blocked version of the worker loop, advancing its strip temporal_blocks[stage] iterations between barriers
+template <typename T, stencil_kind S>
+void temporal_worker(uint32_t my_id, uint32_t stage, uint32_t first, uint32_t last);
+
+// Tiled version of the worker loop, taking tiles of each sweep from the stage's tile scheduler
+template <typename T, stencil_kind S>
+void tile_worker(uint32_t my_id, uint32_t stage);
+
+// Updates row i of the target grid from the source grid, with whichever kernels are active. With residual, returns the
+// largest absolute change made to any point of the row
+template <typename T, stencil_kind S>
+inline double update_row(uint32_t stage, BasicGrid<T>& src_grid, BasicGrid<T>& tgt_grid, uint32_t i, bool residual);
 
-// My implementation of a counter barrier
-inline void my_barrier(uint32_t stage);
+// Updates points [first_col, last_col) of row i of the target grid from the source grid, as update_row
+template <typename T, stencil_kind S>
+inline double update_span(uint32_t stage, BasicGrid<T>& src_grid, BasicGrid<T>& tgt_grid, uint32_t i, uint32_t first_col,
+                          uint32_t last_col, bool residual);
+
+// Waits at the barrier of the given stage
+inline void stage_barrier(uint32_t stage, uint32_t my_id);
+
+// Value published by one worker for one round of an exchange between all the workers of a stage
+struct worker_slot;
+
+// Publishes worker my_id's value for the given round of an exchange through slots
+inline void publish(std::vector<worker_slot>& slots, uint32_t stage, uint32_t my_id, uint32_t round, double value);
+
+// Waits for every worker's value for the given round of an exchange through slots, and copies them into values
+inline void collect(std::vector<worker_slot>& slots, uint32_t stage, uint32_t round, double *values);
+
+// Waits for every worker's residual for the check'th convergence check of the given stage, and returns whether the
+// largest is below convergence_epsilon
+inline bool converged(uint32_t stage, uint32_t check, double *residuals);
+
+// Moves the strip boundaries of the given stage towards equal strip times, given each worker's time for its strip
+void rebalance(uint32_t stage, std::vector<uint32_t>& bounds, const double *times);
+
+// Initializes worker my_id's strip of both grids for the given stage, setting boundaries to 1.0 and interior points to 0.0
+template <typename T>
+void initialize_strip(uint32_t my_id, uint32_t stage);
+
+// Allocates both grids of T
+template <typename T>
+void allocate_grids();
+
+// Sets the affinity of worker my_id for the given stage, if it has changed since the worker's last job
+void pin_worker(uint32_t my_id, uint32_t stage);
 
 // Performs the jacobi kernel. Computes the average of the given point's four neighbors in the source grid and stores it in the target grid
-inline void basic_kernel_small(std::vector<std::vector<double>>& src_grid, std::vector<std::vector<double>>& tgt_grid, uint32_t i, uint32_t j);
+template <typename T>
+inline void basic_kernel_small(BasicGrid<T>& src_grid, BasicGrid<T>& tgt_grid, uint32_t i, uint32_t j);
 
 // Performs a larger version of the jacobi kernel. Computes average of the given point's 5x5 neighborhood in the source grid and stores it in the target grid
-inline void basic_kernel_large(std::vector<std::vector<double>>& src_grid, std::vector<std::vector<double>>& tgt_grid, uint32_t i, uint32_t j);
+template <typename T>
+inline void basic_kernel_large(BasicGrid<T>& src_grid, BasicGrid<T>& tgt_grid, uint32_t i, uint32_t j);
 
 // Executes the relevant kernels set by the experiment parameters
 inline void execute_kernels(uint32_t stage, uint32_t i, uint32_t j);
 
-// Simulate a convergence test. Computes the maximum difference in given strip and sets the global_max_difference variable
-inline void convergence_test(uint32_t first, uint32_t last, uint32_t stage, uint32_t id);
 
 
 
 std::string randomised_seed;
 
-// Set of pthread barriers (one for each stage)
-std::vector<pthread_barrier_t> pthread_barriers;
+// Set of barriers (one for each stage)
+std::vector<std::unique_ptr<Barrier>> stage_barriers;
 
-// Mutex semaphore for my barrier
-pthread_mutex_t my_barrier_mutex;
 
-// Condition variable for leaving my barrier
-pthread_cond_t go;
 
-// Count of the number who have arrived at my barrier   
-uint32_t num_arrived = 0;
+// Experiment parameters
+uint32_t num_runs, grid_size, num_stages, use_set_num_repeats;
 
+// Instruction set for the SIMD kernels
+simd_isa stencil_isa;
 
+// Stencil to run, and the element type of the grids
+stencil_kind stencil;
+element_precision precision;
 
-// Experiment parameters
-uint32_t num_runs, grid_size, num_stages, use_set_num_repeats;
+// Type of barrier to use, and how long its waiters spin for
+barrier_type barrier_kind;
+uint32_t barrier_spin;
+
+// Residual below which a stage has converged (0 never converges), and the number of iterations between checks
+double convergence_epsilon;
+uint32_t convergence_check;
+
+// Iterations between rebalances of the strip boundaries (0 never rebalances)
+uint32_t adaptive_partition;
+
+// How sweeps are shared out, and the size of each tile with the tiled schedules
+tile_schedule sweep_schedule;
+uint32_t tile_rows, tile_cols;
 
 // Stage parameters
-std::vector<uint32_t> num_workers, num_iterations, set_pin_bool;
+std::vector<uint32_t> num_workers, num_iterations, set_pin_bool, temporal_blocks;
 std::vector<std::vector<uint32_t>> kernels, kernel_durations, kernel_repeats, row_allocations;
 std::vector<std::vector<std::vector<uint32_t>>> pinnings;
 
-// Experiment data
-std::vector<std::vector<double>> grid1, grid2;
+// Experiment data, for each element type. Only the grids of the selected precision are ever allocated
+template <typename T>
+struct grid_pair {
+	static BasicGrid<T> grid1, grid2;
+};
+
+template <typename T> BasicGrid<T> grid_pair<T>::grid1;
+template <typename T> BasicGrid<T> grid_pair<T>::grid2;
 
-// Used for convergence test
-std::vector<std::vector<double>> global_max_difference;
+// Row kernels of the SIMD stencils for each element type, with and without the residual. Picked at startup for the
+// stencil and the cpu we are running on
+template <typename T>
+struct row_kernels {
+	static row_kernel<T> plain, residual;
+};
+
+template <typename T> row_kernel<T> row_kernels<T>::plain;
+template <typename T> row_kernel<T> row_kernels<T>::residual;
+
+// Whether workers compute residuals and check for convergence. Always with CONVERGENCE_TEST builds, which measure the
+// cost of the check even when no epsilon is set
+bool check_convergence;
+
+// Value published by one worker for one round of an exchange between all the workers of a stage, on its own cache line
+struct worker_slot {
+	double value;
+
+	// Number of the round the value is for, plus one
+	std::atomic<uint32_t> round;
+
+	char padding[64 - sizeof(double) - sizeof(std::atomic<uint32_t>)];
+};
+
+// Residual and strip time slots of each stage, indexed by [(round % 2) * num_workers + worker]. Two sets, as no worker
+// can publish round + 2 until every worker has collected round
+std::vector<std::vector<worker_slot>> residual_slots, timing_slots;
+
+// Number of iterations each stage ran for in the last run
+std::vector<uint32_t> iterations_run;
+
+// Tile schedulers of each stage, with the tiled schedules
+std::vector<std::unique_ptr<TileScheduler>> tile_schedulers;
 
 
 
 // Border size of our grids
 static uint32_t const border_size = 2;
 
+// Number of rows either side of a point which the given stencil reads
+static constexpr uint32_t stencil_radius(stencil_kind s) {
+
+	return (s == basic_large_stencil || s == simd_large_stencil) ? 2 : 1;
+}
+
+// Imbalance between strip times, relative to the mean, below which adaptive partitioning leaves the boundaries alone
+static double const adaptive_tolerance = 0.05;
+
 
 
 int main(int argc, char *argv[]) {
@@ -136,6 +227,22 @@ int main(int argc, char *argv[]) {
 	// Read config
 	read_config(config);
 
+	// Pick row kernels for our cpu
+	bool large = stencil == simd_large_stencil;
+
+	row_kernels<double>::plain    = large ? select_large_row_kernel<double>(stencil_isa, false) : select_small_row_kernel<double>(stencil_isa, false);
+	row_kernels<double>::residual = large ? select_large_row_kernel<double>(stencil_isa, true)  : select_small_row_kernel<double>(stencil_isa, true);
+	row_kernels<float>::plain     = large ? select_large_row_kernel<float>(stencil_isa, false)  : select_small_row_kernel<float>(stencil_isa, false);
+	row_kernels<float>::residual  = large ? select_large_row_kernel<float>(stencil_isa, true)   : select_small_row_kernel<float>(stencil_isa, true);
+
+	// Pick the worker loop and grid initialization for our precision and stencil once, so none of the choices are
+	// made in the sweeps themselves
+	stage_job run_stage  = precision == float_precision ? select_worker<float>(stencil) : select_worker<double>(stencil);
+	stage_job init_strip = precision == float_precision ? initialize_strip<float> : initialize_strip<double>;
+
+	check_convergence = convergence_epsilon > 0.0;
+	CVG(check_convergence = true;)
+
 	// Read randomised seed
 	SCP(randomised_seed = std::string(argv[2]));
 
@@ -186,12 +293,21 @@ int main(int argc, char *argv[]) {
 		row_allocations.push_back(temp);
 	}
 
-	// Set global max difference vector size
-	global_max_difference.resize(num_stages);
-
-	// Set per stage global max difference vector sizes
+	// Create residual slots for each stage
 	for (uint32_t i = 0; i < num_stages; i++) {
-		global_max_difference.at(i).resize(num_workers.at(i));
+		residual_slots.push_back(std::vector<worker_slot>(2 * num_workers.at(i)));
+		timing_slots.push_back(std::vector<worker_slot>(2 * num_workers.at(i)));
+	}
+
+	iterations_run = num_iterations;
+
+	// Create tile schedulers for each stage
+	if (sweep_schedule != static_schedule) {
+		uint32_t num_tiles = ((grid_size + tile_rows - 1) / tile_rows) * ((grid_size + tile_cols - 1) / tile_cols);
+
+		for (uint32_t i = 0; i < num_stages; i++) {
+			tile_schedulers.push_back(std::unique_ptr<TileScheduler>(new TileScheduler(num_tiles, num_workers.at(i), sweep_schedule)));
+		}
 	}
 
 
@@ -199,26 +315,28 @@ int main(int argc, char *argv[]) {
 	// Calculate the max number of workers we will need
 	uint32_t max_num_workers = *max_element(std::begin(num_workers), std::end(num_workers));
 
-  	// Create thread handles
-	std::vector<std::thread> threads(max_num_workers);
-
-	// Initialize mutex and condition variable for my barrier
-	pthread_mutex_init(&my_barrier_mutex, NULL);
-	pthread_cond_init(&go, NULL);
+  	// Create the worker team once, each stage runs on its first num_workers workers
+	WorkerTeam team(max_num_workers, barrier_spin);
 
-	// Initialize pthread barriers
+	// Initialize barriers
 	for (uint32_t i = 0; i < num_stages; i++) {
-		pthread_barrier_t b;
-		pthread_barrier_init(&b, NULL, num_workers.at(i));
-		pthread_barriers.push_back(b);
+		stage_barriers.push_back(make_barrier(barrier_kind, num_workers.at(i), barrier_spin));
 	}
 
 	// Initialize run times sum for computing average
 	uint32_t run_times_sum = 0;
 
+	// Allocate the grids once, their pages are placed by the first touch in initialize_strip
+	if (precision == float_precision) {
+		allocate_grids<float>();
+	} else {
+		allocate_grids<double>();
+	}
+
 	for (uint32_t r = 1; r < num_runs + 1; r++) {
 
-		initialize_grids();
+		// Initialize the grids in place, each worker taking its first stage strip
+		team.run(num_workers.at(0), [init_strip](uint32_t id) { init_strip(id, 0); });
 
 		SCP(cross_proc_barrier());
          
@@ -227,15 +345,19 @@ int main(int argc, char *argv[]) {
 
 		for (uint32_t stage = 0; stage < num_stages; stage++) {
 
-			// Create workers
-			for (uint32_t i = 0; i < num_workers.at(stage); i++) {
-				threads.at(i) = std::thread(worker, i, stage);
+			// Clear residuals and timings left from the last run
+			for (uint32_t i = 0; i < 2 * num_workers.at(stage); i++) {
+				residual_slots.at(stage).at(i).round = 0;
+				timing_slots.at(stage).at(i).round   = 0;
 			}
 
-			// Join with workers
-			for (uint32_t i = 0; i < num_workers.at(stage); i++) {
-				threads.at(i).join();
+			// Hand every tile back to its owner
+			if (sweep_schedule != static_schedule) {
+				tile_schedulers.at(stage)->reset();
 			}
+
+			// Run the stage on the team, and wait for it to finish
+			team.run(num_workers.at(stage), [run_stage, stage](uint32_t id) { run_stage(id, stage); });
 		}
 
 		// Calculate time taken
@@ -247,6 +369,13 @@ int main(int argc, char *argv[]) {
 		// Print runtime
 		print("\nRun ", r, "\nElapsed time: ", millis.count(), "ms\n");
 
+		// Print any stages which stopped early
+		for (uint32_t stage = 0; stage < num_stages; stage++) {
+			if (iterations_run.at(stage) < num_iterations.at(stage)) {
+				print("Stage ", stage + 1, " converged after ", iterations_run.at(stage), " iterations\n");
+			}
+		}
+
 		// Record runtime
 		fputs((std::to_string(millis.count()) + "\n").c_str(), output_stream);
 
@@ -263,126 +392,540 @@ int main(int argc, char *argv[]) {
 
 
 
+// Returns the worker loop for grids of T and the given stencil
+template <typename T>
+stage_job select_worker(stencil_kind stencil) {
+
+	switch (stencil) {
+		case basic_small_stencil:
+			return worker<T, basic_small_stencil>;
+		case basic_large_stencil:
+			return worker<T, basic_large_stencil>;
+		case simd_small_stencil:
+			return worker<T, simd_small_stencil>;
+		case simd_large_stencil:
+			return worker<T, simd_large_stencil>;
+		default:
+			return worker<T, no_stencil>;
+	}
+}
+
+
+
 // Each Worker computes values in one strip of the grids. The main worker loop does two computations to avoid copying from one grid to the other
+template <typename T, stencil_kind S>
 void worker(uint32_t my_id, uint32_t stage) {
 
 	// Set our affinity
-	force_affinity_set(pinnings.at(stage).at(my_id));
+	pin_worker(my_id, stage);
 
-	// Determine first and last rows of my strip of the grids
-	uint32_t first = row_allocations.at(stage).at(my_id);
-	uint32_t last = row_allocations.at(stage).at(my_id + 1);
+	if (sweep_schedule != static_schedule) {
+		tile_worker<T, S>(my_id, stage);
+
+		return;
+	}
+
+	if (temporal_blocks.at(stage) > 1) {
+		temporal_worker<T, S>(my_id, stage, row_allocations.at(stage).at(my_id), row_allocations.at(stage).at(my_id + 1));
+
+		return;
+	}
+
+	// Strip boundaries of every worker. Each worker keeps its own copy, and they move identically when rebalanced
+	std::vector<uint32_t> bounds(row_allocations.at(stage));
+
+	// Values collected from every worker
+	std::vector<double> exchanged(num_workers.at(stage));
 
 	// Create grid pointers
-	std::vector<std::vector<double>>* src_grid = &grid1;
-	std::vector<std::vector<double>>* tgt_grid = &grid2;
+	BasicGrid<T>* src_grid = &grid_pair<T>::grid1;
+	BasicGrid<T>* tgt_grid = &grid_pair<T>::grid2;
+
+	uint32_t iter = 0, check = 0, rebalances = 0;
+
+	while (iter < num_iterations.at(stage)) {
 
-	for (uint32_t iter = 0; iter < num_iterations.at(stage); iter++) {
+		// Determine first and last rows of my strip of the grids
+		uint32_t first = bounds.at(my_id);
+		uint32_t last  = bounds.at(my_id + 1);
+
+		// Compute the residual of this sweep, if we are checking for convergence after it
+		bool checking = check_convergence && (iter + 1) % convergence_check == 0;
+
+		// Time this sweep, if we are rebalancing after it
+		bool balancing = adaptive_partition != 0 && (iter + 1) % adaptive_partition == 0;
+
+		std::chrono::steady_clock::time_point sweep_start;
+
+		if (balancing) {
+			sweep_start = std::chrono::steady_clock::now();
+		}
+
+		double residual = 0.0;
 
 		// Update my points
 		for (uint32_t i = first; i < last; i++) {
-			for (uint32_t j = border_size; j < grid_size + border_size; j++) {
+			residual = std::max(residual, update_row<T, S>(stage, *(src_grid), *(tgt_grid), i, checking));
+		}
 
-				BKS(basic_kernel_small(*(src_grid), *(tgt_grid), i, j);)
+		if (balancing) {
+			std::chrono::duration<double> sweep_time = std::chrono::steady_clock::now() - sweep_start;
 
-				BKL(basic_kernel_large(*(src_grid), *(tgt_grid), i, j);)
+			publish(timing_slots[stage], stage, my_id, rebalances, sweep_time.count());
+		}
 
-				EXK(execute_kernels(stage, i, j);)
-			}
+		if (checking) {
+			publish(residual_slots[stage], stage, my_id, check, residual);
 		}
 
 		// Barriers
-		MB(my_barrier(stage);)
-		PTB(pthread_barrier_wait(&pthread_barriers.at(stage));)
+		stage_barrier(stage, my_id);
+
+		// Flip grid pointers
+		BasicGrid<T>* temp = src_grid;
+		src_grid = tgt_grid;
+		tgt_grid = temp;
+
+		iter++;
+
+		// Every worker sees the same residuals, so all stop at the same iteration
+		if (checking && converged(stage, check++, exchanged.data())) {
+			break;
+		}
+
+		// Every worker sees the same times, so all move the boundaries the same way. Collecting waits for every
+		// worker to finish its sweep, so strips can move by any amount
+		if (balancing) {
+			collect(timing_slots[stage], stage, rebalances++, exchanged.data());
+
+			rebalance(stage, bounds, exchanged.data());
+		}
+	}
+
+	if (my_id == 0) {
+		iterations_run.at(stage) = iter;
+
+		// Keep the balanced boundaries for the next run
+		if (rebalances != 0) {
+			row_allocations.at(stage) = bounds;
+		}
+	}
+}
+
+
+
+// Temporally blocked version of the worker loop. Iterations are done in blocks of up to temporal_blocks[stage], using
+// split tiling so each block needs only two barriers:
+//
+// Phase 1 - Each worker advances a trapezoid of its strip, which shrinks by stencil_radius rows at each internal strip
+//           edge per iteration, so it depends only on the worker's own rows. Rows are swept as a wavefront, computing
+//           each iteration of a row as soon as the rows it reads are ready, so a tile of rows stays in cache for every
+//           iteration of the block.
+//
+// Phase 2 - After a barrier, each worker fills in the inverted triangle at its top strip edge, which depends only on
+//           the trapezoids either side of it.
+//
+// Only two grids are needed, as no row is overwritten before every row reading it has been computed
+template <typename T, stencil_kind S>
+void temporal_worker(uint32_t my_id, uint32_t stage, uint32_t first, uint32_t last) {
+
+	uint32_t const r = stencil_radius(S);
+
+	// Whether our trapezoid shrinks at its top and bottom. Edges on the grid border stay put
+	bool shrink_top    = first != border_size;
+	bool shrink_bottom = last  != grid_size + border_size;
+
+	// Limit the block so that no trapezoid or triangle grows past the strips either side of it
+	uint32_t min_height = grid_size;
+
+	for (uint32_t w = 0; w < num_workers.at(stage); w++) {
+		min_height = std::min(min_height, row_allocations.at(stage).at(w + 1) - row_allocations.at(stage).at(w));
+	}
+
+	uint32_t block = std::min(temporal_blocks.at(stage), min_height / (2 * r) + 1);
+
+	// Residuals collected from every worker
+	std::vector<double> exchanged(num_workers.at(stage));
+
+	// Grid pointers, grids[0] always holds the latest complete iteration
+	BasicGrid<T>* grids[2] = {&grid_pair<T>::grid1, &grid_pair<T>::grid2};
+
+	uint32_t iter = 0, check = 0;
+
+	while (iter < num_iterations.at(stage)) {
+
+		uint32_t steps = std::min(block, num_iterations.at(stage) - iter);
+
+		// Compute the residual of the last step of this block, if it passes a multiple of convergence_check. Between
+		// them, phase 1 and phase 2 compute each row of the last step exactly once
+		bool checking = check_convergence && (iter + steps) / convergence_check > iter / convergence_check;
+
+		double residual = 0.0;
+
+		// Phase 1, skewed sweep of our trapezoid. Iteration s of row p - (s - 1) * r is computed at position p
+		for (uint32_t p = first; p < last + (steps - 1) * r; p++) {
+			for (uint32_t s = 1; s <= steps; s++) {
+
+				if (p < first + (s - 1) * r) {
+					break;
+				}
+
+				uint32_t i  = p - (s - 1) * r;
+				uint32_t lo = shrink_top    ? first + (s - 1) * r : first;
+				uint32_t hi = shrink_bottom ? last  - (s - 1) * r : last;
+
+				if (i >= lo && i < hi) {
+					residual = std::max(residual, update_row<T, S>(stage, *(grids[(s - 1) % 2]), *(grids[s % 2]), i,
+					                                               checking && s == steps));
+				}
+			}
+		}
+
+		stage_barrier(stage, my_id);
+
+		// Phase 2, the triangle around our top edge, one iteration at a time
+		if (shrink_top) {
+			for (uint32_t s = 2; s <= steps; s++) {
+				for (uint32_t i = first - (s - 1) * r; i < first + (s - 1) * r; i++) {
+					residual = std::max(residual, update_row<T, S>(stage, *(grids[(s - 1) % 2]), *(grids[s % 2]), i,
+					                                               checking && s == steps));
+				}
+			}
+		}
+
+		if (checking) {
+			publish(residual_slots[stage], stage, my_id, check, residual);
+		}
 
-  		// Simulate convergence test
-		CVG(convergence_test(first, last, stage, my_id);)
+		stage_barrier(stage, my_id);
 
 		// Flip grid pointers
-		std::vector<std::vector<double>>* temp = src_grid;
+		if (steps % 2 == 1) {
+			std::swap(grids[0], grids[1]);
+		}
+
+		iter += steps;
+
+		if (checking && converged(stage, check++, exchanged.data())) {
+			break;
+		}
+	}
+
+	if (my_id == 0) {
+		iterations_run.at(stage) = iter;
+	}
+}
+
+
+
+// Tiled version of the worker loop. Each sweep is cut into tile_rows x tile_cols tiles, which workers take from the
+// stage's tile scheduler, their own tiles first. Tiles can be anywhere in the grid, so every sweep ends with a full
+// barrier
+template <typename T, stencil_kind S>
+void tile_worker(uint32_t my_id, uint32_t stage) {
+
+	TileScheduler& tiles = *(tile_schedulers.at(stage));
+
+	uint32_t tiles_across = (grid_size + tile_cols - 1) / tile_cols;
+
+	// Residuals collected from every worker
+	std::vector<double> exchanged(num_workers.at(stage));
+
+	// Create grid pointers
+	BasicGrid<T>* src_grid = &grid_pair<T>::grid1;
+	BasicGrid<T>* tgt_grid = &grid_pair<T>::grid2;
+
+	uint32_t iter = 0, check = 0;
+
+	while (iter < num_iterations.at(stage)) {
+
+		// Compute the residual of this sweep, if we are checking for convergence after it
+		bool checking = check_convergence && (iter + 1) % convergence_check == 0;
+
+		double residual = 0.0;
+
+		// Ready our tiles for the next sweep. Everyone has finished taking tiles of the last sweep, which used the same
+		// cursors, and no one takes tiles of the next until after the barrier
+		tiles.reset(my_id, iter + 1);
+
+		uint32_t begin, end;
+
+		while (tiles.take(my_id, iter, begin, end)) {
+			for (uint32_t t = begin; t < end; t++) {
+
+				uint32_t first_row = border_size + (t / tiles_across) * tile_rows;
+				uint32_t last_row  = std::min(first_row + tile_rows, grid_size + border_size);
+				uint32_t first_col = border_size + (t % tiles_across) * tile_cols;
+				uint32_t last_col  = std::min(first_col + tile_cols, grid_size + border_size);
+
+				for (uint32_t i = first_row; i < last_row; i++) {
+					residual = std::max(residual, update_span<T, S>(stage, *(src_grid), *(tgt_grid), i, first_col, last_col, checking));
+				}
+			}
+		}
+
+		if (checking) {
+			publish(residual_slots[stage], stage, my_id, check, residual);
+		}
+
+		// Barriers
+		stage_barrier(stage, my_id);
+
+		// Flip grid pointers
+		BasicGrid<T>* temp = src_grid;
 		src_grid = tgt_grid;
 		tgt_grid = temp;
+
+		iter++;
+
+		if (checking && converged(stage, check++, exchanged.data())) {
+			break;
+		}
 	}
+
+	if (my_id == 0) {
+		iterations_run.at(stage) = iter;
+	}
+}
+
+
+
+// Updates row i of the target grid from the source grid, with whichever kernels are active. With residual, returns the
+// largest absolute change made to any point of the row
+template <typename T, stencil_kind S>
+inline double update_row(uint32_t stage, BasicGrid<T>& src_grid, BasicGrid<T>& tgt_grid, uint32_t i, bool residual) {
+
+	return update_span<T, S>(stage, src_grid, tgt_grid, i, border_size, grid_size + border_size, residual);
 }
 
 
 
-// Initialize the grids (grid1 and grid2), set boundaries to 1.0 and interior points to 0.0
-void initialize_grids() {
+// Updates points [first_col, last_col) of row i of the target grid from the source grid, with whichever kernels are
+// active. With residual, returns the largest absolute change made to any of them. The stencil is a template
+// parameter, so each instantiation only holds the code of its own
+template <typename T, stencil_kind S>
+inline double update_span(uint32_t stage, BasicGrid<T>& src_grid, BasicGrid<T>& tgt_grid, uint32_t i, uint32_t first_col,
+                          uint32_t last_col, bool residual) {
 
-	grid1.resize(grid_size + (2 * border_size));
-	grid2.resize(grid_size + (2 * border_size));
- 
- 	// Set all points to 0.0
-	for (uint32_t i = 0; i < grid_size + (2 * border_size); i++) {
-		grid1[i].resize(grid_size + (2 * border_size));
-		grid2[i].resize(grid_size + (2 * border_size));
+	double max_change = 0.0;
 
-		std::fill(grid1[i].begin(), grid1[i].end(), 0.0);
-		std::fill(grid2[i].begin(), grid2[i].end(), 0.0);
+	if (S == simd_small_stencil || S == simd_large_stencil) {
+		row_kernel<T> kernel = residual ? row_kernels<T>::residual : row_kernels<T>::plain;
+
+		max_change = kernel(src_grid.row(i), tgt_grid.row(i), src_grid.pitch(), first_col, last_col);
 	}
 
-	// Set edges to 1.0
-	for (uint32_t i = 0; i < grid_size + (2 * border_size); i++) {
+	for (uint32_t j = first_col; j < last_col; j++) {
+
+		if (S == basic_small_stencil) {
+			basic_kernel_small(src_grid, tgt_grid, i, j);
+		}
+
+		if (S == basic_large_stencil) {
+			basic_kernel_large(src_grid, tgt_grid, i, j);
+		}
+
+		EXK(execute_kernels(stage, i, j);)
+
+		if ((S == basic_small_stencil || S == basic_large_stencil) && residual) {
+			max_change = std::max(max_change, std::fabs((double) tgt_grid(i, j) - (double) src_grid(i, j)));
+		}
+	}
+
+	return max_change;
+}
+
+
+
+// Waits at the barrier of the given stage
+inline void stage_barrier(uint32_t stage, uint32_t my_id) {
+
+	stage_barriers[stage]->wait(my_id);
+}
+
+
+
+// Publishes worker my_id's value for the given round of an exchange through slots
+inline void publish(std::vector<worker_slot>& slots, uint32_t stage, uint32_t my_id, uint32_t round, double value) {
+
+	worker_slot& slot = slots[(round % 2) * num_workers[stage] + my_id];
+
+	slot.value = value;
+	slot.round.store(round + 1, std::memory_order_release);
+}
+
+
 
+// Waits for every worker's value for the given round of an exchange through slots, and copies them into values. Every
+// worker collects the same values, so decisions made from them agree without any further communication
+inline void collect(std::vector<worker_slot>& slots, uint32_t stage, uint32_t round, double *values) {
+
+	for (uint32_t w = 0; w < num_workers[stage]; w++) {
+
+		worker_slot& slot = slots[(round % 2) * num_workers[stage] + w];
+
+		// Spin for a while, then yield to any worker sharing our core
+		for (uint32_t spins = 0; slot.round.load(std::memory_order_acquire) != round + 1; spins++) {
+
+			if (spins < 1024) {
+				__builtin_ia32_pause();
+
+			} else {
+				sched_yield();
+			}
+		}
+
+		values[w] = slot.value;
+	}
+}
+
+
+
+// Waits for every worker's residual for the check'th convergence check of the given stage, and returns whether the
+// largest is below convergence_epsilon. Each worker reduces the slots itself, so there is no shared total to contend on
+inline bool converged(uint32_t stage, uint32_t check, double *residuals) {
+
+	collect(residual_slots[stage], stage, check, residuals);
+
+	return *std::max_element(residuals, residuals + num_workers[stage]) < convergence_epsilon;
+}
+
+
+
+// Moves the strip boundaries of the given stage towards equal strip times, given each worker's time for its strip.
+// Each strip's new share of the rows is proportional to how fast it got through its old rows, and boundaries only move
+// halfway there each time, to damp out noise in the timings. Nothing moves while the slowest strip is within
+// adaptive_tolerance of the mean
+void rebalance(uint32_t stage, std::vector<uint32_t>& bounds, const double *times) {
+
+	uint32_t n = num_workers.at(stage);
+
+	double slowest = *std::max_element(times, times + n);
+	double mean    = std::accumulate(times, times + n, 0.0) / n;
+
+	if (n < 2 || slowest <= mean * (1.0 + adaptive_tolerance)) {
+		return;
+	}
+
+	std::vector<uint32_t> old_bounds(bounds);
+
+	// Rows per second of each strip
+	std::vector<double> speeds(n);
+
+	for (uint32_t w = 0; w < n; w++) {
+		speeds.at(w) = (old_bounds.at(w + 1) - old_bounds.at(w)) / std::max(times[w], 1e-9);
+	}
+
+	double total_speed = std::accumulate(speeds.begin(), speeds.end(), 0.0);
+
+	// Place each boundary, keeping every strip at least stencil_radius rows high so that neighbour sync still only needs
+	// the strips either side
+	double end = border_size;
+
+	for (uint32_t w = 0; w < n - 1; w++) {
+		double height = old_bounds.at(w + 1) - old_bounds.at(w);
+		double target = grid_size * speeds.at(w) / total_speed;
+
+		end += height + (target - height) / 2;
+
+		uint32_t boundary = (uint32_t) (end + 0.5);
+
+		bounds.at(w + 1) = std::min(std::max(boundary, bounds.at(w) + stencil_radius(stencil)),
+		                            grid_size + border_size - (n - w - 1) * stencil_radius(stencil));
+	}
+}
+
+
+
+// Initializes worker my_id's strip of both grids for the given stage, setting boundaries to 1.0 and interior points to
+// 0.0. The first and last workers also take the border rows beyond their strips. Run by each worker on the first
+// touch of the grids, so every page lands on the node of the worker which computes it
+template <typename T>
+void initialize_strip(uint32_t my_id, uint32_t stage) {
+
+	BasicGrid<T>& grid1 = grid_pair<T>::grid1;
+	BasicGrid<T>& grid2 = grid_pair<T>::grid2;
+
+	pin_worker(my_id, stage);
+
+	uint32_t first = row_allocations.at(stage).at(my_id);
+	uint32_t last  = row_allocations.at(stage).at(my_id + 1);
+
+	if (my_id == 0) {
+		first = 0;
+	}
+
+	if (my_id == num_workers.at(stage) - 1) {
+		last = grid_size + (2 * border_size);
+	}
+
+	for (uint32_t i = first; i < last; i++) {
+
+		// Set edges to 1.0, and all other points to 0.0
 		if (i < border_size || i > grid_size + border_size - 1) {
-			std::fill(grid1[i].begin(), grid1[i].end(), 1.0);
-			std::fill(grid2[i].begin(), grid2[i].end(), 1.0);
+			grid1.fill_rows(i, i + 1, 1.0);
+			grid2.fill_rows(i, i + 1, 1.0);
 
 		} else {
+			grid1.fill_rows(i, i + 1, 0.0);
+			grid2.fill_rows(i, i + 1, 0.0);
 
 			for (uint32_t j = 0; j < border_size; j++) {
-				grid1[i][j] = 1.0;
-				grid1[i][grid_size + (2 * border_size) - j - 1] = 1.0;
-				grid2[i][j] = 1.0;
-				grid2[i][grid_size + (2 * border_size) - j - 1] = 1.0;
+				grid1(i, j) = 1.0;
+				grid1(i, grid_size + (2 * border_size) - j - 1) = 1.0;
+				grid2(i, j) = 1.0;
+				grid2(i, grid_size + (2 * border_size) - j - 1) = 1.0;
 			}
 		}
-	} 		
+	}
 }
 
 
 
-// My implementation of a counter barrier
-inline void my_barrier(uint32_t stage) {
+// Allocates both grids of T. Contents are left for initialize_strip
+template <typename T>
+void allocate_grids() {
 
-	pthread_mutex_lock(&my_barrier_mutex);
+	grid_pair<T>::grid1.allocate(grid_size + (2 * border_size), grid_size + (2 * border_size));
+	grid_pair<T>::grid2.allocate(grid_size + (2 * border_size), grid_size + (2 * border_size));
+}
 
-  	num_arrived++;
 
-  	if (num_arrived == num_workers.at(stage)) {
 
-    	num_arrived = 0;
-    	pthread_cond_broadcast(&go);
+// Sets the affinity of worker my_id for the given stage, if it has changed since the worker's last job
+void pin_worker(uint32_t my_id, uint32_t stage) {
 
-  	} else {
+	static thread_local std::vector<uint32_t> my_pinning;
 
-    	pthread_cond_wait(&go, &my_barrier_mutex);
-	}
+	if (my_pinning != pinnings.at(stage).at(my_id)) {
+		force_affinity_set(pinnings.at(stage).at(my_id));
 
-  	pthread_mutex_unlock(&my_barrier_mutex);
+		my_pinning = pinnings.at(stage).at(my_id);
+	}
 }
 
 
 
 // Performs the jacobi kernel. Computes the average of the given point's four neighbors in the source grid and stores it in the target grid
-inline void basic_kernel_small(std::vector<std::vector<double>>& src_grid, std::vector<std::vector<double>>& tgt_grid, uint32_t i, uint32_t j) {
+template <typename T>
+inline void basic_kernel_small(BasicGrid<T>& src_grid, BasicGrid<T>& tgt_grid, uint32_t i, uint32_t j) {
 
-	tgt_grid[i][j] = (src_grid[i - 1][j] + src_grid[i + 1][j] + src_grid[i][j - 1] + src_grid[i][j + 1]) * 0.25;
+	tgt_grid(i, j) = (src_grid(i - 1, j) + src_grid(i + 1, j) + src_grid(i, j - 1) + src_grid(i, j + 1)) * 0.25;
 }
 
 
 
 // Performs a larger version of the jacobi kernel. Computes average of the given point's 5x5 neighborhood in the source grid and stores it in the target grid
-inline void basic_kernel_large(std::vector<std::vector<double>>& src_grid, std::vector<std::vector<double>>& tgt_grid, uint32_t i, uint32_t j) {
+template <typename T>
+inline void basic_kernel_large(BasicGrid<T>& src_grid, BasicGrid<T>& tgt_grid, uint32_t i, uint32_t j) {
 
-	tgt_grid[i][j]  = (src_grid[i - 2][j + 2] + src_grid[i - 1][j + 2] + src_grid[i][j + 2] + src_grid[i + 1][j + 2] + src_grid[i + 2][j + 2]);
-	tgt_grid[i][j] += (src_grid[i - 2][j + 1] + src_grid[i - 1][j + 1] + src_grid[i][j + 1] + src_grid[i + 1][j + 1] + src_grid[i + 2][j + 1]);
-	tgt_grid[i][j] += (src_grid[i - 2][j]     + src_grid[i - 1][j]                          + src_grid[i + 1][j]     + src_grid[i + 2][j]);
-	tgt_grid[i][j] += (src_grid[i - 2][j - 1] + src_grid[i - 1][j - 1] + src_grid[i][j - 1] + src_grid[i + 1][j - 1] + src_grid[i + 2][j - 1]);
-	tgt_grid[i][j] += (src_grid[i - 2][j - 2] + src_grid[i - 1][j - 2] + src_grid[i][j - 2] + src_grid[i + 1][j - 2] + src_grid[i + 2][j - 2]);
+	tgt_grid(i, j)  = (src_grid(i - 2, j + 2) + src_grid(i - 1, j + 2) + src_grid(i, j + 2) + src_grid(i + 1, j + 2) + src_grid(i + 2, j + 2));
+	tgt_grid(i, j) += (src_grid(i - 2, j + 1) + src_grid(i - 1, j + 1) + src_grid(i, j + 1) + src_grid(i + 1, j + 1) + src_grid(i + 2, j + 1));
+	tgt_grid(i, j) += (src_grid(i - 2, j)     + src_grid(i - 1, j)                          + src_grid(i + 1, j)     + src_grid(i + 2, j));
+	tgt_grid(i, j) += (src_grid(i - 2, j - 1) + src_grid(i - 1, j - 1) + src_grid(i, j - 1) + src_grid(i + 1, j - 1) + src_grid(i + 2, j - 1));
+	tgt_grid(i, j) += (src_grid(i - 2, j - 2) + src_grid(i - 1, j - 2) + src_grid(i, j - 2) + src_grid(i + 1, j - 2) + src_grid(i + 2, j - 2));
 
-	tgt_grid[i][j] = tgt_grid[i][j] / 24;
+	tgt_grid(i, j) = tgt_grid(i, j) / 24;
 }
 
 
@@ -421,27 +964,3 @@ inline void execute_kernels(uint32_t stage, uint32_t i, uint32_t j) {
 		}
 	}
 }
-
-
-
-// Simulate a convergence test. Computes the maximum difference in given strip and sets the global_max_difference variable
-inline void convergence_test(uint32_t first, uint32_t last, uint32_t stage, uint32_t id) {
-
-  	double max_diff = 0.0;
-
-	for (uint32_t i = first; i < last; i++) {
-		for (uint32_t j = border_size; j < grid_size + border_size; j++) {
-			uint32_t temp = grid1[i][j] - grid2[i][j];
-
-			if (temp < 0) {
-				temp = -temp;
-			}
-
-			if (max_diff < temp) {
-				max_diff = temp;
-			}
-		}
-	}
-
-	global_max_difference[stage][id] = max_diff;
-}
\ No newline at end of file
@@ -0,0 +1,154 @@
+#ifndef BARRIERS_HPP
+#define BARRIERS_HPP
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+
+// Types of barrier, selectable at runtime
+enum barrier_type {condvar_barrier = 0, pthread_barrier = 1, sense_barrier = 2, dissemination_barrier = 3,
+                   hybrid_barrier = 4, neighbour_barrier = 5};
+
+#define NUM_BARRIER_TYPES 6
+
+// Config names of each barrier type, in barrier_type order
+extern std::string barrier_names[NUM_BARRIER_TYPES];
+
+// Default number of times a waiting thread spins before it yields or sleeps
+#define DEFAULT_BARRIER_SPIN 4096
+
+
+
+// Size of a cache line, used to keep per-thread flags from sharing lines
+#define BARRIER_CACHE_LINE 64
+
+// Flag padded out to a whole cache line
+struct padded_flag {
+    std::atomic<uint32_t> value;
+
+    char padding[BARRIER_CACHE_LINE - sizeof(std::atomic<uint32_t>)];
+};
+
+
+
+// Barrier for a fixed number of threads, each of which passes its own id in [0, num_threads) to wait
+class Barrier {
+public:
+    virtual ~Barrier() {}
+
+    // Blocks until every thread has called wait
+    virtual void wait(uint32_t id) = 0;
+};
+
+// Returns a barrier of the given type for num_threads threads. spin is the number of times a waiting thread spins
+// before it yields (spinning barriers) or sleeps (hybrid barrier)
+std::unique_ptr<Barrier> make_barrier(barrier_type type, uint32_t num_threads, uint32_t spin = DEFAULT_BARRIER_SPIN);
+
+
+
+// Counter barrier built from a mutex and a condition variable. Every waiter sleeps, and is woken through the kernel
+class CondvarBarrier : public Barrier {
+public:
+    CondvarBarrier(uint32_t num_threads);
+    ~CondvarBarrier();
+
+    void wait(uint32_t id);
+
+private:
+    pthread_mutex_t mutex;
+    pthread_cond_t go;
+
+    uint32_t num_threads, num_arrived, generation;
+};
+
+// Wrapper around pthread_barrier_t
+class PthreadBarrier : public Barrier {
+public:
+    PthreadBarrier(uint32_t num_threads);
+    ~PthreadBarrier();
+
+    void wait(uint32_t id);
+
+private:
+    pthread_barrier_t barrier;
+};
+
+// Centralised sense-reversing barrier. Threads count in on one shared counter, and the last to arrive flips a shared
+// sense flag, which everyone else spins on
+class SenseBarrier : public Barrier {
+public:
+    SenseBarrier(uint32_t num_threads, uint32_t spin);
+
+    void wait(uint32_t id);
+
+private:
+    uint32_t num_threads, spin;
+
+    padded_flag count, sense;
+
+    // Sense each thread waits for next
+    std::vector<padded_flag> local_sense;
+};
+
+// Dissemination barrier. In round k each thread signals thread (id + 2^k) % num_threads and waits for the signal from
+// thread (id - 2^k) % num_threads, so after ceil(log2(num_threads)) rounds every thread has heard from every other.
+// Each thread only ever spins on its own flags, and no location is written by more than one thread per round
+class DisseminationBarrier : public Barrier {
+public:
+    DisseminationBarrier(uint32_t num_threads, uint32_t spin);
+
+    void wait(uint32_t id);
+
+private:
+    uint32_t num_threads, num_rounds, spin;
+
+    // Flags each thread spins on, indexed by [(thread * 2 + parity) * num_rounds + round]. Flags alternate between
+    // two sets, so a fast thread's signals for one episode never clobber those of the last
+    std::vector<padded_flag> flags;
+
+    // Per thread parity and sense
+    std::vector<padded_flag> parity, sense;
+};
+
+// Centralised barrier whose waiters spin for a limited budget, then sleep on a futex until the last thread to arrive
+// wakes them. Cheap when threads arrive close together, and does not burn cores when they do not
+class HybridBarrier : public Barrier {
+public:
+    HybridBarrier(uint32_t num_threads, uint32_t spin);
+
+    void wait(uint32_t id);
+
+private:
+    uint32_t num_threads, spin;
+
+    padded_flag count;
+
+    // Incremented by the last thread to arrive. Waiters sleep on it
+    padded_flag generation;
+
+    // Number of waiters which may be asleep, so the last thread only makes the wake system call when needed
+    padded_flag sleepers;
+};
+
+// Point to point synchronisation for threads working on a 1D chain of strips. Each thread publishes how many times it
+// has arrived, on its own cache line, and waits only for threads id - 1 and id + 1. Not a full barrier, threads
+// further away may still be behind, but enough for a stencil which only reads its neighbours' boundary rows
+class NeighbourBarrier : public Barrier {
+public:
+    NeighbourBarrier(uint32_t num_threads, uint32_t spin);
+
+    void wait(uint32_t id);
+
+private:
+    uint32_t num_threads, spin;
+
+    std::vector<padded_flag> counters;
+};
+
+#endif // BARRIERS_HPP
@@ -11,14 +11,44 @@
 #include <thread>
 
 #include <general_utils.hpp>
+#include <stencil_kernels.hpp>
+#include <barriers.hpp>
+#include <tile_scheduler.hpp>
 
 
 
 extern uint32_t num_runs, grid_size, num_stages, use_set_num_repeats;
-extern std::vector<uint32_t> num_workers, num_iterations, set_pin_bool, strip_size;
+extern std::vector<uint32_t> num_workers, num_iterations, set_pin_bool, strip_size, temporal_blocks;
 extern std::vector<std::vector<uint32_t>> kernels, kernel_durations, kernel_repeats;
 extern std::vector<std::vector<std::vector<uint32_t>>> pinnings;
 
+// Instruction set for the SIMD stencil kernels, the widest the cpu supports unless the optional simd_isa key is set
+extern simd_isa stencil_isa;
+
+// Stencil each sweep runs and the element type of the grids, set by the optional stencil and precision keys. The
+// stencil defaults to the one picked by the old kernel build flags, if any, and the precision to double
+extern stencil_kind stencil;
+extern element_precision precision;
+
+// Barrier used between sweeps, and how many times its waiters spin before yielding or sleeping. Set by the optional
+// barrier and barrier_spin keys
+extern barrier_type barrier_kind;
+extern uint32_t barrier_spin;
+
+// Set by the optional convergence_epsilon and convergence_check keys. A stage stops early once no point changes by
+// convergence_epsilon or more in an iteration, checking every convergence_check iterations
+extern double convergence_epsilon;
+extern uint32_t convergence_check;
+
+// Set by the optional adaptive_partition key. Every adaptive_partition iterations, workers time their strips and move
+// the boundaries between them to even out the times. 0 keeps the even split. Stages with temporal blocking never move
+extern uint32_t adaptive_partition;
+
+// Set by the optional schedule, tile_rows and tile_cols keys. The tiled schedules need a full barrier, so override a
+// neighbour barrier, and replace temporal blocking and adaptive partitioning
+extern tile_schedule sweep_schedule;
+extern uint32_t tile_rows, tile_cols;
+
 
 
 // Returns the current working directory
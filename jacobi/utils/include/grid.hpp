@@ -0,0 +1,106 @@
+#ifndef GRID_HPP
+#define GRID_HPP
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include <general_utils.hpp>
+
+
+
+// Alignment of the grid buffer and of the start of every row
+#define GRID_ALIGNMENT 64
+
+// Row pitches which are a multiple of this many bytes map every row onto the same cache sets, so are padded
+#define GRID_ALIAS_BYTES 4096
+
+
+
+// A 2D grid of T held in one aligned, contiguous buffer. Rows are padded out to a pitch which keeps every row aligned,
+// and which is never a multiple of GRID_ALIAS_BYTES, so that the rows a stencil reads at once do not all compete for
+// the same cache sets
+template <typename T>
+class BasicGrid {
+public:
+    BasicGrid() : data(NULL), num_rows(0), num_cols(0), row_pitch(0) {}
+
+    ~BasicGrid() {
+
+        free(data);
+    }
+
+    BasicGrid(const BasicGrid&) = delete;
+    BasicGrid& operator=(const BasicGrid&) = delete;
+
+    // (Re)allocates the grid to the given size, if it is not that size already. Contents are left uninitialised, so
+    // the first thread to write each row decides where its pages live
+    void allocate(uint32_t rows, uint32_t cols) {
+
+        if (data != NULL && rows == num_rows && cols == num_cols) {
+            return;
+        }
+
+        free(data);
+
+        uint32_t elements_per_line = GRID_ALIGNMENT / sizeof(T);
+
+        row_pitch = ((cols + elements_per_line - 1) / elements_per_line) * elements_per_line;
+
+        if ((row_pitch * sizeof(T)) % GRID_ALIAS_BYTES == 0) {
+            row_pitch += elements_per_line;
+        }
+
+        num_rows = rows;
+        num_cols = cols;
+
+        if (posix_memalign((void **) &data, GRID_ALIGNMENT, (size_t) num_rows * row_pitch * sizeof(T)) != 0) {
+            print("ERROR: Cannot allocate grid of ", num_rows, "x", num_cols, "\n");
+            exit(1);
+        }
+    }
+
+    // Returns a pointer to the start of the given row
+    inline T* row(uint32_t i) {
+
+        return data + (size_t) i * row_pitch;
+    }
+
+    inline const T* row(uint32_t i) const {
+
+        return data + (size_t) i * row_pitch;
+    }
+
+    inline T& operator()(uint32_t i, uint32_t j) {
+
+        return data[(size_t) i * row_pitch + j];
+    }
+
+    inline const T& operator()(uint32_t i, uint32_t j) const {
+
+        return data[(size_t) i * row_pitch + j];
+    }
+
+    // Sets every point of rows [first, last) to value
+    void fill_rows(uint32_t first, uint32_t last, T value) {
+
+        for (uint32_t i = first; i < last; i++) {
+            std::fill(row(i), row(i) + num_cols, value);
+        }
+    }
+
+    uint32_t rows() const { return num_rows; }
+    uint32_t cols() const { return num_cols; }
+
+    // Distance between the starts of consecutive rows, in elements
+    uint32_t pitch() const { return row_pitch; }
+
+private:
+    T *data;
+
+    uint32_t num_rows, num_cols, row_pitch;
+};
+
+typedef BasicGrid<double> Grid;
+
+#endif // GRID_HPP
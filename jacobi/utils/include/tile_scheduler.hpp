@@ -0,0 +1,65 @@
+#ifndef TILE_SCHEDULER_HPP
+#define TILE_SCHEDULER_HPP
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <barriers.hpp>
+
+
+
+// Ways of sharing out each sweep between the workers, as with map_array's schedules:
+//
+// static  - Each worker sweeps its own fixed strip of rows
+// dynamic - The grid is cut into tiles. Each worker takes its own tiles one at a time, then steals single tiles from the
+//           others once its own run out
+// tapered - As dynamic, but each worker takes half its remaining tiles at a time, so chunks start large and shrink
+enum tile_schedule {static_schedule = 0, dynamic_schedule = 1, tapered_schedule = 2};
+
+#define NUM_TILE_SCHEDULES 3
+
+// Config names of each schedule, in tile_schedule order
+extern std::string tile_schedule_names[NUM_TILE_SCHEDULES];
+
+// Default tile size, in points
+#define DEFAULT_TILE_ROWS 64
+#define DEFAULT_TILE_COLS 256
+
+
+
+// Hands out the tiles of each sweep. Every worker owns a fixed, contiguous run of tile indices, which it always takes
+// first, so without interference a worker sweeps the same tiles every iteration and finds them still in its cache.
+// Each worker's run has an atomic cursor, which thieves advance too. Cursors come in two sets, used by alternate
+// rounds, so each worker can reset its cursor for the next round while others are still taking tiles from this one
+class TileScheduler {
+public:
+    TileScheduler(uint32_t num_tiles, uint32_t num_workers, tile_schedule schedule);
+
+    // Resets every cursor of both rounds. Only safe while no worker is taking tiles
+    void reset();
+
+    // Resets worker id's cursor for the given round. Only safe once no one can still be taking tiles of round - 2
+    void reset(uint32_t id, uint32_t round);
+
+    // Takes the next chunk of tiles for worker id in the given round, from its own run if any are left, otherwise
+    // stolen from another worker. Returns false once every tile of the round has been taken
+    bool take(uint32_t id, uint32_t round, uint32_t &begin, uint32_t &end);
+
+private:
+    // Takes up to chunk tiles from worker owner's run. Returns false if the run is used up
+    bool take_from(uint32_t owner, uint32_t round, uint32_t chunk, uint32_t &begin, uint32_t &end);
+
+    uint32_t num_workers;
+
+    tile_schedule schedule;
+
+    // Run of tiles owned by each worker, worker w owns [runs[w], runs[w + 1])
+    std::vector<uint32_t> runs;
+
+    // Next tile of each run, indexed by [(round % 2) * num_workers + worker]
+    std::vector<padded_flag> cursors;
+};
+
+#endif // TILE_SCHEDULER_HPP
@@ -0,0 +1,62 @@
+#ifndef WORKER_TEAM_HPP
+#define WORKER_TEAM_HPP
+
+#include <stdint.h>
+
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include <barriers.hpp>
+
+
+
+// Job run by each active worker, given its id
+typedef std::function<void(uint32_t)> team_job;
+
+
+
+// A fixed team of worker threads which lives for the whole process. Each call to run hands a job to the first
+// num_active workers, so stages can change their worker count without creating or joining threads, and each worker
+// keeps its pinning and the caches and pages it has warmed up between jobs. Idle workers spin for a while, then sleep
+// on a futex
+class WorkerTeam {
+public:
+    // Starts num_workers threads, which wait for a job
+    WorkerTeam(uint32_t num_workers, uint32_t spin = DEFAULT_BARRIER_SPIN);
+
+    // Stops and joins every worker
+    ~WorkerTeam();
+
+    WorkerTeam(const WorkerTeam&) = delete;
+    WorkerTeam& operator=(const WorkerTeam&) = delete;
+
+    // Runs job(id) on workers [0, num_active), and blocks until all of them have returned
+    void run(uint32_t num_active, team_job job);
+
+    uint32_t size() const { return threads.size(); }
+
+private:
+    void worker_loop(uint32_t id);
+
+    std::vector<std::thread> threads;
+
+    team_job job;
+
+    uint32_t spin;
+
+    bool stopping;
+
+    // Number of jobs handed to each worker. Only active workers are signalled, so idle workers stay asleep and never
+    // read a job being set up for someone else
+    std::vector<padded_flag> started;
+
+    // Number of active workers still running the current job. run sleeps on it
+    padded_flag remaining;
+
+    // Set while each worker, or run, may be asleep on its flag, so that the futex is only woken when someone is on it
+    std::vector<padded_flag> worker_sleeping;
+    padded_flag run_sleeping;
+};
+
+#endif // WORKER_TEAM_HPP
@@ -0,0 +1,277 @@
+#include "barriers.hpp"
+
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+
+
+// Config names of each barrier type, in barrier_type order
+std::string barrier_names[NUM_BARRIER_TYPES] = {"condvar", "pthread", "sense", "dissemination", "hybrid", "neighbour"};
+
+
+
+// Sleeps while the futex word at addr holds the expected value
+static void futex_wait(std::atomic<uint32_t> *addr, uint32_t expected) {
+
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+// Wakes every thread sleeping on the futex word at addr
+static void futex_wake_all(std::atomic<uint32_t> *addr) {
+
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+// Spins until flag holds at least (or exactly) the given value. Yields the core once the spin budget is used up, so
+// oversubscribed threads still let the threads they wait for run
+static inline void spin_until_equal(std::atomic<uint32_t> &flag, uint32_t value, uint32_t spin) {
+
+    for (uint32_t i = 0; flag.load(std::memory_order_acquire) != value; i++) {
+        if (i < spin) {
+            __builtin_ia32_pause();
+
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+static inline void spin_until_at_least(std::atomic<uint32_t> &flag, uint32_t value, uint32_t spin) {
+
+    for (uint32_t i = 0; flag.load(std::memory_order_acquire) < value; i++) {
+        if (i < spin) {
+            __builtin_ia32_pause();
+
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+
+
+// Returns a barrier of the given type for num_threads threads
+std::unique_ptr<Barrier> make_barrier(barrier_type type, uint32_t num_threads, uint32_t spin) {
+
+    switch (type) {
+        case condvar_barrier:
+            return std::unique_ptr<Barrier>(new CondvarBarrier(num_threads));
+
+        case pthread_barrier:
+            return std::unique_ptr<Barrier>(new PthreadBarrier(num_threads));
+
+        case sense_barrier:
+            return std::unique_ptr<Barrier>(new SenseBarrier(num_threads, spin));
+
+        case dissemination_barrier:
+            return std::unique_ptr<Barrier>(new DisseminationBarrier(num_threads, spin));
+
+        case hybrid_barrier:
+            return std::unique_ptr<Barrier>(new HybridBarrier(num_threads, spin));
+
+        case neighbour_barrier:
+            return std::unique_ptr<Barrier>(new NeighbourBarrier(num_threads, spin));
+
+        default:
+            return std::unique_ptr<Barrier>();
+    }
+}
+
+
+
+CondvarBarrier::CondvarBarrier(uint32_t num_threads) : num_threads(num_threads), num_arrived(0), generation(0) {
+
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&go, NULL);
+}
+
+CondvarBarrier::~CondvarBarrier() {
+
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&go);
+}
+
+void CondvarBarrier::wait(uint32_t id) {
+
+    pthread_mutex_lock(&mutex);
+
+    uint32_t my_generation = generation;
+
+    num_arrived++;
+
+    if (num_arrived == num_threads) {
+        num_arrived = 0;
+        generation++;
+
+        pthread_cond_broadcast(&go);
+
+    } else {
+        // Loop to ignore spurious wakeups
+        while (my_generation == generation) {
+            pthread_cond_wait(&go, &mutex);
+        }
+    }
+
+    pthread_mutex_unlock(&mutex);
+}
+
+
+
+PthreadBarrier::PthreadBarrier(uint32_t num_threads) {
+
+    pthread_barrier_init(&barrier, NULL, num_threads);
+}
+
+PthreadBarrier::~PthreadBarrier() {
+
+    pthread_barrier_destroy(&barrier);
+}
+
+void PthreadBarrier::wait(uint32_t id) {
+
+    pthread_barrier_wait(&barrier);
+}
+
+
+
+SenseBarrier::SenseBarrier(uint32_t num_threads, uint32_t spin) : num_threads(num_threads), spin(spin),
+                                                                  local_sense(num_threads) {
+    count.value = 0;
+    sense.value = 0;
+
+    for (auto& s : local_sense) {
+        s.value = 0;
+    }
+}
+
+void SenseBarrier::wait(uint32_t id) {
+
+    uint32_t my_sense = !local_sense[id].value.load(std::memory_order_relaxed);
+
+    local_sense[id].value.store(my_sense, std::memory_order_relaxed);
+
+    if (count.value.fetch_add(1, std::memory_order_acq_rel) == num_threads - 1) {
+        // Last to arrive, reset the count for next time then release everyone
+        count.value.store(0, std::memory_order_relaxed);
+        sense.value.store(my_sense, std::memory_order_release);
+
+    } else {
+        spin_until_equal(sense.value, my_sense, spin);
+    }
+}
+
+
+
+DisseminationBarrier::DisseminationBarrier(uint32_t num_threads, uint32_t spin) : num_threads(num_threads), spin(spin),
+                                                                                  parity(num_threads),
+                                                                                  sense(num_threads) {
+    num_rounds = 0;
+
+    while ((1u << num_rounds) < num_threads) {
+        num_rounds++;
+    }
+
+    flags = std::vector<padded_flag>(num_threads * 2 * (num_rounds > 0 ? num_rounds : 1));
+
+    for (auto& f : flags) {
+        f.value = 0;
+    }
+
+    for (uint32_t i = 0; i < num_threads; i++) {
+        parity[i].value = 0;
+        sense[i].value  = 1;
+    }
+}
+
+void DisseminationBarrier::wait(uint32_t id) {
+
+    uint32_t my_parity = parity[id].value.load(std::memory_order_relaxed);
+    uint32_t my_sense  = sense[id].value.load(std::memory_order_relaxed);
+
+    for (uint32_t k = 0; k < num_rounds; k++) {
+        uint32_t partner = (id + (1u << k)) % num_threads;
+
+        flags[(partner * 2 + my_parity) * num_rounds + k].value.store(my_sense, std::memory_order_release);
+
+        spin_until_equal(flags[(id * 2 + my_parity) * num_rounds + k].value, my_sense, spin);
+    }
+
+    // Flip sense every other episode, as the two sets of flags are used in turn
+    if (my_parity == 1) {
+        sense[id].value.store(!my_sense, std::memory_order_relaxed);
+    }
+
+    parity[id].value.store(1 - my_parity, std::memory_order_relaxed);
+}
+
+
+
+HybridBarrier::HybridBarrier(uint32_t num_threads, uint32_t spin) : num_threads(num_threads), spin(spin) {
+
+    count.value      = 0;
+    generation.value = 0;
+    sleepers.value   = 0;
+}
+
+void HybridBarrier::wait(uint32_t id) {
+
+    uint32_t my_generation = generation.value.load(std::memory_order_acquire);
+
+    if (count.value.fetch_add(1, std::memory_order_acq_rel) == num_threads - 1) {
+        // Last to arrive, reset the count for next time then release everyone, waking any sleepers
+        count.value.store(0, std::memory_order_relaxed);
+        generation.value.fetch_add(1, std::memory_order_seq_cst);
+
+        if (sleepers.value.load(std::memory_order_seq_cst) != 0) {
+            futex_wake_all(&generation.value);
+        }
+
+        return;
+    }
+
+    // Spin for our budget
+    for (uint32_t i = 0; i < spin; i++) {
+        if (generation.value.load(std::memory_order_acquire) != my_generation) {
+            return;
+        }
+
+        __builtin_ia32_pause();
+    }
+
+    // Then sleep. Announcing ourselves before checking the generation means the last thread either sees us, or we
+    // see its new generation and never sleep
+    sleepers.value.fetch_add(1, std::memory_order_seq_cst);
+
+    while (generation.value.load(std::memory_order_seq_cst) == my_generation) {
+        futex_wait(&generation.value, my_generation);
+    }
+
+    sleepers.value.fetch_sub(1, std::memory_order_relaxed);
+}
+
+
+
+NeighbourBarrier::NeighbourBarrier(uint32_t num_threads, uint32_t spin) : num_threads(num_threads), spin(spin),
+                                                                          counters(num_threads) {
+    for (auto& c : counters) {
+        c.value = 0;
+    }
+}
+
+void NeighbourBarrier::wait(uint32_t id) {
+
+    uint32_t arrived = counters[id].value.load(std::memory_order_relaxed) + 1;
+
+    counters[id].value.store(arrived, std::memory_order_release);
+
+    if (id > 0) {
+        spin_until_at_least(counters[id - 1].value, arrived, spin);
+    }
+
+    if (id + 1 < num_threads) {
+        spin_until_at_least(counters[id + 1].value, arrived, spin);
+    }
+}
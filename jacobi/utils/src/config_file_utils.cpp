@@ -8,6 +8,35 @@
 
 std::string kernel_names[NUM_KERNELS] = {"none", "cpu", "io", "vm", "hdd"};
 
+// Values of the simd_isa key, in simd_isa order
+std::string simd_isa_keys[] = {"scalar", "sse2", "avx2", "avx512"};
+
+// Values of the stencil and precision keys, in stencil_kind and element_precision order
+std::string stencil_keys[] = {"none", "basic_small", "basic_large", "simd_small", "simd_large"};
+std::string precision_keys[] = {"double", "float"};
+
+// Stencil used when the stencil key is not set. The old kernel build flags still pick it
+#if defined(BASIC_KERNEL_SMALL)
+#define DEFAULT_STENCIL basic_small_stencil
+#elif defined(BASIC_KERNEL_LARGE)
+#define DEFAULT_STENCIL basic_large_stencil
+#elif defined(SIMD_KERNEL_SMALL)
+#define DEFAULT_STENCIL simd_small_stencil
+#elif defined(SIMD_KERNEL_LARGE)
+#define DEFAULT_STENCIL simd_large_stencil
+#else
+#define DEFAULT_STENCIL no_stencil
+#endif
+
+// Barrier used when the barrier key is not set. The old barrier build flags still pick it
+#if defined(PTHREAD_BARRIER)
+#define DEFAULT_BARRIER pthread_barrier
+#elif defined(NEIGHBOUR_SYNC)
+#define DEFAULT_BARRIER neighbour_barrier
+#else
+#define DEFAULT_BARRIER condvar_barrier
+#endif
+
 
 // Returns the current working directory
 std::string get_current_working_dir() {
@@ -175,6 +204,120 @@ void read_config(std::map<std::string, std::string> config) {
 	check_iterator(it, config.end());
 	num_stages = atoi(it->second.c_str());
 
+	// Optional, use the widest instruction set the cpu supports unless told otherwise
+	stencil_isa = detect_simd_isa();
+
+	it = config.find("simd_isa");
+
+	if (it != config.end() && it->second != "auto") {
+		uint32_t isa = std::distance(simd_isa_keys, std::find(simd_isa_keys, simd_isa_keys + avx512_isa + 1, it->second));
+
+		if (isa > avx512_isa) {
+			print("Malformed config file!");
+			exit(1);
+		}
+
+		if (isa > stencil_isa) {
+			print("WARNING: ", simd_isa_names[isa], " is not supported, using ", simd_isa_names[stencil_isa], "\n");
+
+		} else {
+			stencil_isa = (simd_isa) isa;
+		}
+	}
+
+	// Optional, stencil and element type by name
+	stencil = DEFAULT_STENCIL;
+
+	it = config.find("stencil");
+
+	if (it != config.end()) {
+		uint32_t s = std::distance(stencil_keys, std::find(stencil_keys, stencil_keys + simd_large_stencil + 1, it->second));
+
+		if (s > simd_large_stencil) {
+			print("Malformed config file!");
+			exit(1);
+		}
+
+		stencil = (stencil_kind) s;
+	}
+
+	precision = double_precision;
+
+	it = config.find("precision");
+
+	if (it != config.end()) {
+		uint32_t p = std::distance(precision_keys, std::find(precision_keys, precision_keys + float_precision + 1, it->second));
+
+		if (p > float_precision) {
+			print("Malformed config file!");
+			exit(1);
+		}
+
+		precision = (element_precision) p;
+	}
+
+	// Optional, barrier type by name
+	barrier_kind = DEFAULT_BARRIER;
+
+	it = config.find("barrier");
+
+	if (it != config.end()) {
+		uint32_t type = std::distance(barrier_names, std::find(barrier_names, barrier_names + NUM_BARRIER_TYPES, it->second));
+
+		if (type >= NUM_BARRIER_TYPES) {
+			print("Malformed config file!");
+			exit(1);
+		}
+
+		barrier_kind = (barrier_type) type;
+	}
+
+	// Optional, spin budget of the spinning and hybrid barriers
+	it = config.find("barrier_spin");
+	barrier_spin = it != config.end() ? atoi(it->second.c_str()) : DEFAULT_BARRIER_SPIN;
+
+	// Optional, residual at which stages stop early. 0 always runs every iteration
+	it = config.find("convergence_epsilon");
+	convergence_epsilon = it != config.end() ? atof(it->second.c_str()) : 0.0;
+
+	// Optional, iterations between convergence checks
+	it = config.find("convergence_check");
+	convergence_check = it != config.end() ? std::max(atoi(it->second.c_str()), 1) : 1;
+
+	// Optional, iterations between rebalances of the strip boundaries. 0 never rebalances
+	it = config.find("adaptive_partition");
+	adaptive_partition = it != config.end() ? atoi(it->second.c_str()) : 0;
+
+	// Optional, how sweeps are shared out between workers
+	sweep_schedule = static_schedule;
+
+	it = config.find("schedule");
+
+	if (it != config.end()) {
+		uint32_t schedule = std::distance(tile_schedule_names, std::find(tile_schedule_names, tile_schedule_names + NUM_TILE_SCHEDULES, it->second));
+
+		if (schedule >= NUM_TILE_SCHEDULES) {
+			print("Malformed config file!");
+			exit(1);
+		}
+
+		sweep_schedule = (tile_schedule) schedule;
+	}
+
+	// Optional, tile size of the tiled schedules
+	it = config.find("tile_rows");
+	tile_rows = it != config.end() ? std::max(atoi(it->second.c_str()), 1) : DEFAULT_TILE_ROWS;
+
+	it = config.find("tile_cols");
+	tile_cols = it != config.end() ? std::max(atoi(it->second.c_str()), 1) : DEFAULT_TILE_COLS;
+
+	// Tiles can be anywhere in the grid, so workers must wait for everyone, not just their neighbours
+	if (sweep_schedule != static_schedule && barrier_kind == neighbour_barrier) {
+		print("WARNING: ", tile_schedule_names[sweep_schedule], " schedule needs a full barrier, using ", barrier_names[hybrid_barrier], "\n");
+
+		barrier_kind = hybrid_barrier;
+	}
+
 	for (uint32_t i = 0; i < num_stages; i++) {
 
 		it = config.find("num_workers_" + std::to_string(i));
@@ -189,6 +332,10 @@ void read_config(std::map<std::string, std::string> config) {
 		check_iterator(it, config.end());
 		set_pin_bool.push_back(atoi(it->second.c_str()));
 
+		// Optional, iterations to advance each tile by while it is in cache. 1 sweeps the whole strip every iteration
+		it = config.find("temporal_block_" + std::to_string(i));
+		temporal_blocks.push_back(it != config.end() ? std::max(atoi(it->second.c_str()), 1) : 1);
+
 		std::vector<std::vector<uint32_t>> temp(num_workers.back());
 
 		switch (set_pin_bool.back()) {
@@ -345,7 +492,21 @@ void print_params() {
 	// Print parameters
 	print("\nNumber of runs:    ", num_runs, "\n",
 		  "Grid size:         ", grid_size, "\n",
-		  "Number of stages:  ", num_stages, "\n");
+		  "Number of stages:  ", num_stages, "\n",
+		  "Stencil:           ", stencil_keys[stencil], " (", precision_keys[precision], ")\n",
+		  "SIMD kernels:      ", simd_isa_names[stencil_isa], "\n",
+		  "Barrier:           ", barrier_names[barrier_kind], " (spin ", barrier_spin, ")\n");
+
+	if (convergence_epsilon > 0.0) {
+		print("Convergence:       epsilon ", convergence_epsilon, ", checked every ", convergence_check, " iterations\n");
+	}
+
+	if (sweep_schedule != static_schedule) {
+		print("Schedule:          ", tile_schedule_names[sweep_schedule], ", ", tile_rows, "x", tile_cols, " tiles\n");
+
+	} else if (adaptive_partition != 0) {
+		print("Adaptive strips:   rebalanced every ", adaptive_partition, " iterations\n");
+	}
 
 	// Used for printing set_pin_bool
 	std::vector<std::string> options = {"Each worker has all cores", "Each worker has one corresponding core (max workers = num cores)", "Custom"};
@@ -354,6 +515,7 @@ void print_params() {
 		print("\n\nStage ", i + 1, ":\n\n",
 			  "Number of workers:    ", num_workers.at(i), "\n",
 			  "Number of iterations: ", num_iterations.at(i), "\n",
+			  "Temporal blocking:    ", temporal_blocks.at(i), " iterations per tile\n",
 			  "Set-pinning:          ", options.at(set_pin_bool.at(i)), "\n");
 
 		if (set_pin_bool.at(i) == 2) {
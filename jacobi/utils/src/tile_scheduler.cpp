@@ -0,0 +1,82 @@
+#include "tile_scheduler.hpp"
+
+#include <algorithm>
+
+
+
+// Config names of each schedule, in tile_schedule order
+std::string tile_schedule_names[NUM_TILE_SCHEDULES] = {"static", "dynamic", "tapered"};
+
+
+
+TileScheduler::TileScheduler(uint32_t num_tiles, uint32_t num_workers, tile_schedule schedule) :
+    num_workers(num_workers), schedule(schedule), runs(num_workers + 1, 0), cursors(2 * num_workers) {
+
+    // Split the tiles evenly, handing any remainder to the first workers
+    uint32_t quotient  = num_tiles / num_workers;
+    uint32_t remainder = num_tiles % num_workers;
+
+    for (uint32_t w = 0; w < num_workers; w++) {
+        runs.at(w + 1) = runs.at(w) + quotient + (w < remainder ? 1 : 0);
+    }
+
+    reset();
+}
+
+void TileScheduler::reset() {
+
+    for (uint32_t w = 0; w < num_workers; w++) {
+        reset(w, 0);
+        reset(w, 1);
+    }
+}
+
+void TileScheduler::reset(uint32_t id, uint32_t round) {
+
+    cursors.at((round % 2) * num_workers + id).value.store(runs.at(id), std::memory_order_relaxed);
+}
+
+bool TileScheduler::take(uint32_t id, uint32_t round, uint32_t &begin, uint32_t &end) {
+
+    // Our own tiles first
+    uint32_t chunk = 1;
+
+    if (schedule == tapered_schedule) {
+        uint32_t next = cursors.at((round % 2) * num_workers + id).value.load(std::memory_order_relaxed);
+
+        chunk = std::max((runs.at(id + 1) - std::min(next, runs.at(id + 1))) / 2, 1u);
+    }
+
+    if (take_from(id, round, chunk, begin, end)) {
+        return true;
+    }
+
+    // Then steal single tiles, trying each other worker in turn
+    for (uint32_t i = 1; i < num_workers; i++) {
+        if (take_from((id + i) % num_workers, round, 1, begin, end)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool TileScheduler::take_from(uint32_t owner, uint32_t round, uint32_t chunk, uint32_t &begin, uint32_t &end) {
+
+    std::atomic<uint32_t> &cursor = cursors.at((round % 2) * num_workers + owner).value;
+
+    // Check first, so that thieves do not keep pushing the cursor of a used up run further past its end
+    if (cursor.load(std::memory_order_relaxed) >= runs.at(owner + 1)) {
+        return false;
+    }
+
+    begin = cursor.fetch_add(chunk, std::memory_order_relaxed);
+
+    if (begin >= runs.at(owner + 1)) {
+        return false;
+    }
+
+    end = std::min(begin + chunk, runs.at(owner + 1));
+
+    return true;
+}
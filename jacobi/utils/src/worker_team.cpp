@@ -0,0 +1,130 @@
+#include "worker_team.hpp"
+
+#include <limits.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+
+
+// Sleeps while the futex word at addr holds the expected value
+static void futex_wait(std::atomic<uint32_t> *addr, uint32_t expected) {
+
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+// Wakes every thread sleeping on the futex word at addr
+static void futex_wake_all(std::atomic<uint32_t> *addr) {
+
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+// Spins while flag holds value, for up to spin times, then sleeps until it changes. sleeping is set while we may be
+// asleep. Returns the new value
+static uint32_t wait_while_equal(std::atomic<uint32_t> &flag, uint32_t value, uint32_t spin,
+                                 std::atomic<uint32_t> &sleeping) {
+
+    uint32_t current;
+
+    for (uint32_t i = 0; (current = flag.load(std::memory_order_acquire)) == value; i++) {
+        if (i < spin) {
+            __builtin_ia32_pause();
+
+        } else {
+            // Announce ourselves before checking again, so the signaller either sees us and wakes us, or we see the
+            // change
+            sleeping.store(1);
+
+            if (flag.load() == value) {
+                futex_wait(&flag, value);
+            }
+
+            sleeping.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    return current;
+}
+
+// Wakes the thread waiting on flag, which has just been changed, only if it may be asleep
+static void wake_if_sleeping(std::atomic<uint32_t> &flag, std::atomic<uint32_t> &sleeping) {
+
+    if (sleeping.load() != 0) {
+        futex_wake_all(&flag);
+    }
+}
+
+
+
+WorkerTeam::WorkerTeam(uint32_t num_workers, uint32_t spin) : spin(spin), stopping(false), started(num_workers),
+                                                                worker_sleeping(num_workers) {
+
+    remaining.value    = 0;
+    run_sleeping.value = 0;
+
+    for (uint32_t id = 0; id < num_workers; id++) {
+        started.at(id).value         = 0;
+        worker_sleeping.at(id).value = 0;
+    }
+
+    for (uint32_t id = 0; id < num_workers; id++) {
+        threads.push_back(std::thread(&WorkerTeam::worker_loop, this, id));
+    }
+}
+
+WorkerTeam::~WorkerTeam() {
+
+    stopping = true;
+
+    for (auto& s : started) {
+        s.value.fetch_add(1, std::memory_order_release);
+        futex_wake_all(&s.value);
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+void WorkerTeam::run(uint32_t num_active, team_job job) {
+
+    if (num_active == 0) {
+        return;
+    }
+
+    this->job = job;
+
+    remaining.value.store(num_active, std::memory_order_relaxed);
+
+    // Publish the job to each active worker, waking it if it has gone to sleep. Workers still spinning from the last
+    // stage cost no system call
+    for (uint32_t id = 0; id < num_active; id++) {
+        started.at(id).value.fetch_add(1);
+        wake_if_sleeping(started.at(id).value, worker_sleeping.at(id).value);
+    }
+
+    uint32_t left = num_active;
+
+    while (left != 0) {
+        left = wait_while_equal(remaining.value, left, spin, run_sleeping.value);
+    }
+}
+
+void WorkerTeam::worker_loop(uint32_t id) {
+
+    uint32_t seen = 0;
+
+    while (true) {
+        seen = wait_while_equal(started.at(id).value, seen, spin, worker_sleeping.at(id).value);
+
+        if (stopping) {
+            break;
+        }
+
+        job(id);
+
+        if (remaining.value.fetch_sub(1) == 1) {
+            wake_if_sleeping(remaining.value, run_sleeping.value);
+        }
+    }
+}
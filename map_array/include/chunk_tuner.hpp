@@ -0,0 +1,114 @@
+#ifndef CHUNK_TUNER_HPP
+#define CHUNK_TUNER_HPP
+
+#include <stdint.h>
+#include <chrono>           // steady_clock
+
+using namespace std;
+
+// Weight given to each new measurement in the running averages.
+#define TUNER_SMOOTHING 0.25
+
+// Most the chunk size may grow or shrink by in a single step.
+#define TUNER_MAX_STEP 2.0
+
+
+
+// Returns a monotonic timestamp in nanoseconds. Cheap enough to call around every chunk.
+inline uint64_t tuner_now()
+{
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+
+/*
+ * Online chunk size tuner for the Auto schedule, one per thread. After each chunk the thread reports how long the
+ * chunk took to execute and how long it then waited to get its next chunk. The tuner keeps running averages of the
+ * cost per task and the cost per dispatch, and picks the smallest chunk size which keeps dispatch overhead below the
+ * target fraction of execution time. The chunk size is capped at half of the tasks the thread has left, so the tail
+ * of the run stays finely divided for load balancing.
+ */
+
+class ChunkTuner {
+  public:
+    // Constructor
+    ChunkTuner(uint32_t initial_chunk_size, double target_overhead) :
+      chunk_size(initial_chunk_size > 0 ? initial_chunk_size : 1),
+      target(target_overhead),
+      task_nanos(0.0),
+      dispatch_nanos(0.0),
+      primed(false)
+      {}
+
+    uint32_t chunkSize() const
+    {
+      return chunk_size;
+    }
+
+    // Records the last chunk of num_tasks tasks, which took work_nanos to execute and dispatch_nanos to get the next
+    // chunk. tasks_left is the number of tasks this thread still has to share out. Returns the new chunk size.
+    uint32_t update(uint64_t work_nanos, uint64_t overhead_nanos, uint32_t num_tasks, uint32_t tasks_left)
+    {
+      if (num_tasks == 0)
+      {
+        return chunk_size;
+      }
+
+      double per_task = (double) work_nanos / num_tasks;
+
+      if (primed)
+      {
+        task_nanos     += TUNER_SMOOTHING * (per_task - task_nanos);
+        dispatch_nanos += TUNER_SMOOTHING * ((double) overhead_nanos - dispatch_nanos);
+      }
+      else
+      {
+        task_nanos     = per_task;
+        dispatch_nanos = overhead_nanos;
+        primed         = true;
+      }
+
+      // Smallest chunk for which dispatch overhead stays below the target fraction of work.
+      double wanted = dispatch_nanos / (target * (task_nanos > 1.0 ? task_nanos : 1.0));
+
+      // Move gradually, so one noisy measurement cannot swing the chunk size.
+      if (wanted > chunk_size * TUNER_MAX_STEP)
+      {
+        wanted = chunk_size * TUNER_MAX_STEP;
+      }
+
+      if (wanted < chunk_size / TUNER_MAX_STEP)
+      {
+        wanted = chunk_size / TUNER_MAX_STEP;
+      }
+
+      // Leave at least half of our remaining tasks for later chunks or for thieves.
+      if (wanted > tasks_left / 2)
+      {
+        wanted = tasks_left / 2;
+      }
+
+      chunk_size = (wanted < 1.0) ? 1 : (uint32_t) wanted;
+
+      return chunk_size;
+    }
+
+  private:
+    // Current chunk size.
+    uint32_t chunk_size;
+
+    // Target ratio of dispatch time to work time.
+    double target;
+
+    // Running average of the time taken per task.
+    double task_nanos;
+
+    // Running average of the time taken to get a new chunk.
+    double dispatch_nanos;
+
+    // Whether the averages hold a measurement yet.
+    bool primed;
+};
+
+#endif // CHUNK_TUNER_HPP
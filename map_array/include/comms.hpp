@@ -1,16 +1,34 @@
 #ifndef COMMS_HPP
 #define COMMS_HPP
 
+#include <memory>
+#include <iostream>
+#include <deque>
+#include <vector>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
 #include <zmq.hpp> // ZMQ communication library.
+#include <shm_channel.hpp>
+#include <wire_format.hpp>
 
 using namespace std;
 using namespace zmq;
 
 #define DEFAULT_PORT 5555
+// Most threads one application runs. Messages have no such limit.
 #define MAX_NUM_THREADS 128
 
 
 
+/* Transports between the controller and applications. Zmq_transport - ZMQ DEALER socket over TCP, to the controller's 
+                                                                        ROUTER.
+                                                        Shm_transport - Shared memory rings under /dev/shm, with 
+                                                                        futex wakeups. Same machine only. */
+enum Transport {Zmq_transport, Shm_transport};
+
+
+
 // Structures that are used to pass messages between the controller and applications.
 
 /* Different possible schedules Static             - Give each thread equal portions.
@@ -18,34 +36,50 @@ using namespace zmq;
                                 Dynamic_individual - Threads retrieve a single task when they can.
                                 Tapered            - Chunk size starts off large and decreases to better handle load 
                                                      imbalance between iterations.
-                                Auto               - Automatically try to figure out the best schedule. */
-enum Schedule {Static, Dynamic_chunks, Dynamic_individual, Tapered, Auto};
+                                Auto               - Automatically try to figure out the best schedule.
+                                Dynamic_atomic     - Threads retrieve chunks from a single shared atomic counter. Best
+                                                     suited to tasks of uniform cost. */
+enum Schedule {Static, Dynamic_chunks, Dynamic_individual, Tapered, Auto, Dynamic_atomic};
 
-string Schedules[5] {
+string Schedules[6] {
 	"Static",
 	"Dynamic_chunks", 
 	"Dynamic_individual", 
 	"Tapered", 
-	"Auto"
+	"Auto",
+	"Dynamic_atomic"
 };
 
 struct settings {
 	// How many threads to pin where.
-    int thread_pinnings[MAX_NUM_THREADS];
+    deque<int> thread_pinnings;
 
     // Schedule to use.
-    Schedule schedule;
+    Schedule schedule = Static;
+
+    // Relative cost of the tasks across the input, e.g. 1 1 1 4 means tasks in the last quarter cost 4x as much. Empty 
+    // if not known.
+    deque<uint32_t> task_size_distribution;
 };
 
+static bool operator==(const struct settings &a, const struct settings &b) {
 
+    return a.schedule == b.schedule && a.thread_pinnings == b.thread_pinnings && 
+           a.task_size_distribution == b.task_size_distribution;
+}
 
-// Message headers
-#define CON_REP  0
-#define CON_UPDT 1
 
-#define APP_REG  10
-#define APP_TERM 11
 
+// Message headers, sent as the type of each frame, see wire_format.hpp.
+#define CON_REP  1
+#define CON_UPDT 2
+
+#define APP_REG   10
+#define APP_TERM  11
+#define APP_TELEM 12
+
+// Messages carrying settings, to the application for CON_REP and CON_UPDT, and the settings it asks for with APP_REG. 
+// APP_TERM carries none.
 struct message {
 	int header = -1;
 
@@ -56,46 +90,415 @@ struct message {
 
 
 
-// Receive 0MQ message from socket and convert into a message struct.
-static struct message m_recv(socket_t &socket) {
+// Progress of one thread since the start of the run. Times are in microseconds and wrap around, so the controller only 
+// ever looks at the difference between two reports.
+struct thread_telemetry {
+    // Tasks run.
+    uint32_t tasks_done;
+
+    // Time spent running tasks, and time spent getting them.
+    uint32_t work_micros;
+    uint32_t overhead_micros;
+};
+
+// Progress report sent by an application every telemetry period, as an APP_TELEM frame.
+struct telemetry {
+	uint32_t pid;
+
+	// Tasks not yet handed to any thread.
+	uint32_t tasks_remaining;
+
+	// Time since the start of the run.
+	uint32_t elapsed_micros;
+
+	vector<struct thread_telemetry> threads;
+};
+
+// A telemetry report read in place from the frame it arrived in, which must outlive it.
+struct telemetry_view {
+	uint32_t pid;
+	uint32_t tasks_remaining;
+	uint32_t elapsed_micros;
+
+	wire_array<struct thread_telemetry> threads;
+};
+
+
+
+/* Bodies of each frame type, as 32 bit fields in order, where [] marks an array following its length.
+
+       CON_REP, CON_UPDT, APP_REG - schedule, thread_pinnings[], task_size_distribution[]
+       APP_TERM                   - Empty.
+       APP_TELEM                  - tasks_remaining, elapsed_micros, threads[] of {tasks_done, work_micros, 
+                                    overhead_micros} */
+
+// Write the body of a message struct. Returns its frame type.
+static uint16_t wire_encode(wire_writer &writer, const struct message &to_send) {
+
+    if (to_send.header != APP_TERM) {
+        writer.write((uint32_t) to_send.settings.schedule);
+        writer.write_array<int32_t>(to_send.settings.thread_pinnings.begin(), to_send.settings.thread_pinnings.size());
+        writer.write_array<uint32_t>(to_send.settings.task_size_distribution.begin(), 
+                                     to_send.settings.task_size_distribution.size());
+    }
+
+    return to_send.header;
+}
+
+// Write the body of a telemetry struct. Returns its frame type.
+static uint16_t wire_encode(wire_writer &writer, const struct telemetry &to_send) {
+
+    writer.write(to_send.tasks_remaining);
+    writer.write(to_send.elapsed_micros);
+    writer.write_array<struct thread_telemetry>(to_send.threads.begin(), to_send.threads.size());
+
+    return APP_TELEM;
+}
+
+// Read a message struct from a frame. Returns false if the frame holds no message struct, or is cut short.
+static bool wire_decode(wire_reader &reader, struct message &out) {
+
+    out.header   = reader.type();
+    out.pid      = reader.pid();
+    out.settings = settings();
+
+    switch (out.header) {
+        case CON_REP:
+        case CON_UPDT:
+        case APP_REG:
+            break;
+
+        case APP_TERM:
+            return reader.valid();
+
+        default:
+            return false;
+    }
+
+    uint32_t schedule;
+    wire_array<int32_t> pinnings;
+    wire_array<uint32_t> distribution;
+
+    if (!reader.read(schedule) || !reader.read_array(pinnings) || !reader.read_array(distribution) || 
+        schedule > Dynamic_atomic) {
+        return false;
+    }
+
+    out.settings.schedule = (Schedule) schedule;
+
+    for (uint32_t i = 0; i < pinnings.size(); i++) {
+        out.settings.thread_pinnings.push_back(pinnings[i]);
+    }
+
+    for (uint32_t i = 0; i < distribution.size(); i++) {
+        out.settings.task_size_distribution.push_back(distribution[i]);
+    }
+
+    return true;
+}
+
+// Read a telemetry report from a frame, without copying its threads. Returns false if the frame holds no report, or is 
+// cut short.
+static bool wire_decode(wire_reader &reader, struct telemetry_view &out) {
+
+    out.pid = reader.pid();
+
+    return reader.type() == APP_TELEM && reader.read(out.tasks_remaining) && reader.read(out.elapsed_micros) && 
+           reader.read_array(out.threads);
+}
+
+// Encode a message or telemetry struct into a new ZMQ message, sized exactly by a first pass which only counts.
+template <typename T>
+static message_t wire_frame(const T &to_send) {
+
+    wire_writer counter(NULL, 0);
+    wire_encode(counter, to_send);
+
+    message_t msg(counter.finish(0, 0));
+
+    wire_writer writer(msg.data(), msg.size());
+
+    writer.finish(wire_encode(writer, to_send), to_send.pid);
+
+    return msg;
+}
+
+
+
+// Receive 0MQ message from socket and decode it into a message struct. The header is -1 if it held none.
+static struct message m_recv(socket_t &socket, int flags = 0) {
 
     message_t msg;
-    socket.recv(&msg);
+    struct message out;
 
-    return *(static_cast<struct message*>(msg.data()));
+    if (socket.recv(&msg, flags) == 0) {
+        return out;
+    }
+
+    wire_reader reader(msg.data(), msg.size());
+
+    if (!wire_decode(reader, out)) {
+        out.header = -1;
+    }
+
+    return out;
 }
 
 
 
-// Receive 0MQ message from socket and convert into a message struct.
+// Receive 0MQ message from socket without waiting, and decode it into a message struct. The header is -1 if there was 
+// none.
 static struct message m_no_block_recv(socket_t &socket) {
 
-    message_t msg;
-    int rc = socket.recv(&msg, ZMQ_NOBLOCK);
+    return m_recv(socket, ZMQ_NOBLOCK);
+}
+
+
+
+// Send a message or telemetry struct. With ZMQ_DONTWAIT in flags, returns false rather than block if the socket's 
+// queue is full.
+template <typename T>
+static bool m_send(socket_t &socket, const T &to_send, int flags = 0) {
+
+    message_t msg = wire_frame(to_send);
+
+    return socket.send(msg, flags);
+}
+
+
+
+// Receive a frame from a ROUTER socket into msg, and the identity of the peer which sent it. The frame is read in 
+// place, so msg must outlive the reader.
+static wire_reader f_recv(socket_t &socket, string &identity, message_t &msg) {
+
+    message_t id;
+    socket.recv(&id);
+
+    identity.assign(static_cast<char*>(id.data()), id.size());
+
+    socket.recv(&msg);
+
+    return wire_reader(msg.data(), msg.size());
+}
+
+
+
+// Send a message struct through a ROUTER socket, to the peer with the given identity.
+static bool m_send(socket_t &socket, const string &identity, const struct message &to_send) {
+
+    message_t id(identity.size());
+    memcpy(id.data(), identity.data(), identity.size());
+
+    return socket.send(id, ZMQ_SNDMORE) && m_send(socket, to_send);
+}
+
+
+
+// Receive a message struct from the controller through shared memory, waiting up to timeout_us for one (negative waits 
+// forever). The header is -1 if none arrived.
+static struct message m_recv(ShmAppChannel &channel, int64_t timeout_us) {
+
+    alignas(8) char buffer[SHM_SLOT_BYTES];
 
-    if (rc == 0)
-    {
-        struct message blank;
+    struct message out;
 
-        blank.header = -1;
+    wire_reader reader(buffer, channel.recv(buffer, sizeof(buffer), timeout_us));
 
-        return blank;
+    if (!wire_decode(reader, out)) {
+        out.header = -1;
     }
 
-    return *(static_cast<struct message*>(msg.data()));
+    return out;
 }
 
 
 
-// Send a message struct.
-static bool m_send(socket_t &socket, const struct message &to_send) {
+// Encode a message or telemetry struct into buffer. Returns the frame size, or 0 if it does not fit.
+template <typename T>
+static size_t wire_frame(const T &to_send, char *buffer, size_t capacity) {
 
-    message_t msg(sizeof(to_send));
-    memcpy(msg.data(), &to_send, sizeof(to_send));
+    wire_writer writer(buffer, capacity);
 
-    bool rc = socket.send(msg);
+    return writer.finish(wire_encode(writer, to_send), to_send.pid);
+}
+
+
+
+// Encode a message or telemetry struct into buffer, which holds SHM_SLOT_BYTES, for the shared memory transport. A 
+// frame must fit in one ring slot, so larger ones are logged and rejected. Returns the frame size, or 0 if rejected.
+template <typename T>
+static size_t shm_frame(const T &to_send, char *buffer) {
+
+    size_t size = wire_frame(to_send, buffer, SHM_SLOT_BYTES);
+
+    if (size == 0) {
+        wire_writer counter(NULL, 0);
+        wire_encode(counter, to_send);
 
-    return rc;
+        cerr << "[Comms] Not sending a " << counter.finish(0, 0) << " byte message for PID " << to_send.pid 
+             << ", larger than the " << SHM_SLOT_BYTES << " bytes shared memory allows. Use the ZMQ transport." << endl;
+    }
+
+    return size;
 }
 
+
+
+// Send a message or telemetry struct to the controller through shared memory.
+template <typename T>
+static bool m_send(ShmAppChannel &channel, const T &to_send) {
+
+    alignas(8) char buffer[SHM_SLOT_BYTES];
+
+    size_t size = shm_frame(to_send, buffer);
+
+    return size != 0 && channel.send(buffer, size);
+}
+
+
+
+// Receive a frame from any application through shared memory into buffer, waiting up to timeout_us for one (negative 
+// waits forever). Writes the sender's slot to app_id. The frame is read in place, so buffer must outlive the reader, 
+// which is not valid if nothing arrived.
+static wire_reader f_recv(ShmControllerChannel &channel, uint32_t &app_id, char *buffer, size_t capacity, 
+                          int64_t timeout_us = -1) {
+
+    size_t size = channel.recv(app_id, buffer, capacity, timeout_us);
+
+    return wire_reader(buffer, size <= capacity ? size : 0);
+}
+
+
+
+// Send a message struct to the application in the given slot through shared memory.
+static bool m_send(ShmControllerChannel &channel, uint32_t app_id, const struct message &to_send) {
+
+    alignas(8) char buffer[SHM_SLOT_BYTES];
+
+    size_t size = shm_frame(to_send, buffer);
+
+    return size != 0 && channel.send(app_id, buffer, size);
+}
+
+
+
+// An application's connection to the controller, over either transport. The main thread blocks in wait until either 
+// the controller sends something or another thread calls wake, so it uses no cpu while the workers run.
+class controller_link {
+public:
+    controller_link(Transport transport) : transport(transport), wake_fd(-1) {
+
+        if (transport == Shm_transport) {
+            connected = channel.connect();
+
+        } else {
+            context.reset(new context_t(1));
+            socket.reset(new socket_t(*context, ZMQ_DEALER));
+
+            // Give up on anything still queued shortly after closing, rather than hang on a controller which is gone.
+            int linger_ms = 100;
+
+            socket->setsockopt(ZMQ_LINGER, linger_ms);
+
+            socket->connect("tcp://localhost:" + to_string(DEFAULT_PORT));
+
+            // Polled alongside the socket, so wake can interrupt wait.
+            wake_fd = eventfd(0, EFD_NONBLOCK);
+
+            // ZMQ queues messages until a controller turns up.
+            connected = true;
+        }
+    }
+
+    ~controller_link() {
+
+        if (socket) {
+            socket->close();
+        }
+
+        if (wake_fd != -1) {
+            close(wake_fd);
+        }
+    }
+
+    // Whether a controller can be reached.
+    bool is_connected() const {
+
+        return connected;
+    }
+
+    // Send a message struct to the controller.
+    bool send(const struct message &to_send) {
+
+        return transport == Shm_transport ? m_send(channel, to_send) : m_send(*socket, to_send);
+    }
+
+    // Send a telemetry struct to the controller, never blocking. Returns false, dropping the report, if the 
+    // controller is not keeping up.
+    bool send(const struct telemetry &to_send) {
+
+        return transport == Shm_transport ? m_send(channel, to_send) : m_send(*socket, to_send, ZMQ_DONTWAIT);
+    }
+
+    // Block until the controller sends a message struct, wake is called, or timeout_us passes (negative waits 
+    // forever). The header is -1 if woken or timed out.
+    struct message wait(int64_t timeout_us = -1) {
+
+        if (transport == Shm_transport) {
+            return m_recv(channel, timeout_us);
+        }
+
+        pollitem_t items[] = {{(void *) *socket, 0, ZMQ_POLLIN, 0}, {NULL, wake_fd, ZMQ_POLLIN, 0}};
+
+        // ZMQ polls in milliseconds, so round up rather than spin on sub millisecond timeouts.
+        poll(items, 2, timeout_us < 0 ? -1 : max<long>((timeout_us + 999) / 1000, 1));
+
+        if (items[1].revents & ZMQ_POLLIN) {
+            uint64_t count;
+
+            if (read(wake_fd, &count, sizeof(count)) != sizeof(count)) {
+                // Another wait already took the wakeup.
+            }
+        }
+
+        return m_no_block_recv(*socket);
+    }
+
+    // Receive the next message struct from the controller without blocking. The header is -1 if there was none.
+    struct message try_recv() {
+
+        return transport == Shm_transport ? m_recv(channel, 0) : m_no_block_recv(*socket);
+    }
+
+    // Make the current wait return, or the next one if nobody is waiting. Safe to call from any thread.
+    void wake() {
+
+        if (transport == Shm_transport) {
+            channel.wake();
+
+        } else {
+            uint64_t one = 1;
+
+            if (write(wake_fd, &one, sizeof(one)) != sizeof(one)) {
+                // The counter is already non-zero, so the wakeup is still pending.
+            }
+        }
+    }
+
+private:
+    Transport transport;
+
+    bool connected;
+
+    // Eventfd written by wake, for the ZMQ transport.
+    int wake_fd;
+
+    // ZMQ transport.
+    unique_ptr<context_t> context;
+    unique_ptr<socket_t> socket;
+
+    // Shared memory transport.
+    ShmAppChannel channel;
+};
+
 #endif // COMMS_HPP
\ No newline at end of file
@@ -10,9 +10,12 @@
 #include <boost/thread.hpp> // boost::thread::hardware_concurrency();
 #include <string>
 #include <iostream>
+#include <cassert>          // assert()
+#include <cstdlib>          // posix_memalign()
 
 #include <utils.hpp>
 #include <comms.hpp>
+#include <thread_pool.hpp>
 
 #include <map_array_thread.hpp>
 
@@ -37,19 +40,103 @@ using namespace std;
 
 
 /*
- *  Implementation of the mapArray parallel programming pattern. Currently uses all available cores and splits tasks 
- *  evenly. If the output deque is not big enough, it will be resized.
- *
- *  deque<in1>& input1                              - First input deque to be iterated over.
- *  deque<in2>& input2                              - Second input deque to be passed to user function.
- *  out          (*user_function) (in1, deque<in2>) - User function pointer to a function which takes .
- *                                                     (in1, deque<in2>) and returns an out type.
- *  deque<out>& output                              - deque to store output in.
+ *  Returns the number of consecutive outputs which exactly fill a whole number of cache lines, in grain, and how many 
+ *  outputs before output[0] the first such group would start, in lead. Chunks which start and end on these boundaries 
+ *  never share a cache line of output with another chunk.
  */
 
-template <typename in1, typename in2, typename out>
-void map_array(deque<in1>& input1, deque<in2>& input2, out (*user_function) (in1, deque<in2>), deque<out>& output, 
-               string output_filename = "", parameters params = parameters())
+template <typename out>
+void output_alignment(const out *output, uint32_t &grain, uint32_t &lead)
+{
+  uint32_t a = CACHE_LINE_SIZE;
+  uint32_t b = sizeof(out);
+
+  // Greatest common divisor of the line and element sizes.
+  while (b != 0)
+  {
+    uint32_t t = a % b;
+
+    a = b;
+    b = t;
+  }
+
+  grain = CACHE_LINE_SIZE / a;
+  lead  = 0;
+
+  uintptr_t offset = (uintptr_t) output % CACHE_LINE_SIZE;
+
+  // Find how many elements back the previous line boundary is, if it falls on an element boundary at all.
+  for (uint32_t i = 0; i < grain; i++)
+  {
+    if ((offset + CACHE_LINE_SIZE * sizeof(out) - i * sizeof(out)) % CACHE_LINE_SIZE == 0)
+    {
+      lead = i;
+
+      break;
+    }
+  }
+}
+
+
+
+// Contiguous array with one element per task, which NUMA aware runs place next to the threads working on it.
+struct numa_region
+{
+  // Address of the element of the first task.
+  const void *base;
+
+  // Size of each element.
+  size_t element_size;
+};
+
+
+
+// Tags each thread with the NUMA node of its cpu. If place is set, also moves each thread's first share of every 
+// region to that node.
+template <typename body_t>
+void place_numa_regions(BagOfTasks<body_t> &bot, parameters &params, deque<numa_region> &regions, bool place)
+{
+  uint32_t num_threads = params.thread_pinnings.size();
+
+  for (uint32_t i = 0; i < num_threads; i++)
+  {
+    int node = numa_node_of(params.thread_pinnings.at(i));
+
+    bot.setNode(i, node);
+
+    if (!place)
+    {
+      continue;
+    }
+
+    tasks share = bot.staticShare(i, num_threads);
+
+    for (auto& region : regions)
+    {
+      const char *begin = (const char *) region.base + (size_t) share.begin * region.element_size;
+
+      if (!numa_place(begin, (size_t) (share.end - share.begin) * region.element_size, node))
+      {
+        print("[Main] Could not place thread ", i, "'s data on NUMA node ", node, "\n");
+      }
+    }
+  }
+}
+
+
+
+/*
+ *  Runs the mapArray pattern over num_tasks tasks, handing chunks of task indices to body(thread_id, begin, end) from 
+ *  the persistent thread pool, and following any new schedule sent by the controller while it runs. Used by each of 
+ *  the map_array overloads below. Chunks are made of whole blocks of grain tasks, the first block being lead tasks 
+ *  short, see BagOfTasks. If params.numa_aware is set, the given regions are split between the threads' NUMA nodes. 
+ *  The calling thread sleeps until the controller sends something or the bag runs dry, or with params.main_as_worker 
+ *  runs thread 0 itself.
+ */
+
+template <typename body_t>
+void run_map_array(uint32_t num_tasks, body_t &body, string output_filename, parameters params, 
+                   uint32_t grain = 1, uint32_t lead = 0, deque<numa_region> regions = deque<numa_region>())
 {
   Ms(print("[Main] Metrics on!\n\n"));
 
@@ -59,154 +146,257 @@ void map_array(deque<in1>& input1, deque<in2>& input2, out (*user_function) (in1
   // Print the number of processors we can detect.
   print("[Main] Found ", params.thread_pinnings.size(), " processors\n");
 
-  BagOfTasks<in1, in2, out> bot(input1.begin(), input1.end(), &input2, user_function, output.begin());
+  // The bag only has room for so many threads, as with the pinnings the controller sends.
+  if (params.thread_pinnings.size() > MAX_NUM_THREADS)
+  {
+    print("[Main] Only using the first ", MAX_NUM_THREADS, " of ", params.thread_pinnings.size(), " pinnings\n");
 
-  bot.thread_control.assign(params.thread_pinnings.size(), Execute);
+    params.thread_pinnings.resize(MAX_NUM_THREADS);
+  }
 
-  // Calculate info for data partitioning.
-  deque<thread_data<in1, in2, out>> thread_data_deque = calc_thread_data(bot.numTasksRemaining(), bot, params);
+  BagOfTasks<body_t> bot(num_tasks, &body, grain, lead);
 
-  // Variables for creating and managing threads.
-  deque<pthread_t> threads(params.thread_pinnings.size());
+  // Split tasks between the threads.
+  bot.seed(params.thread_pinnings.size(), params.schedule);
 
-  // Create all our needed threads.
-  for (uint32_t i = 0; i < params.thread_pinnings.size(); i++)
+  // Place each thread's share of the data on its own NUMA node, before any thread touches it.
+  if (params.numa_aware)
   {
-    print("[Main] Creating thread ", i , "\n");
+    print("[Main] NUMA aware, found ", numa_num_nodes(), " nodes\n");
+
+    place_numa_regions(bot, params, regions, true);
+  }
+
+  // Calculate info for data partitioning. Each update from the controller adds a new generation of thread data, and 
+  // old generations are kept until we return, as threads may still be reading them.
+  deque<deque<thread_data<body_t>>> thread_data_generations;
+
+  thread_data_generations.push_back(calc_thread_data(bot.numTasksRemaining(), bot, params));
+
+  // Persistent worker threads, shared by every call.
+  ThreadPool &pool = get_thread_pool();
 
-    int rc = pthread_create(&threads.at(i), NULL, mapArrayThread<in1, in2, out>, (void *) &thread_data_deque.at(i));
+  // Connect to the controller.
+  controller_link link(params.transport);
 
-    // Create thread name.
-    char thread_name[16];
-    sprintf(thread_name, "MA Thread %u", i);
+  // Wake the main thread as soon as the bag runs dry, rather than have it poll.
+  bot.on_empty = [&link] () { link.wake(); };
 
-    // Set thread name to something recognizable.
-    pthread_setname_np(threads.at(i), thread_name);
+  // Get our PID to send to the controller.
+  uint32_t pid = getpid();
+
+  // Start of the run, and when the next telemetry report is due, in nanoseconds.
+  uint64_t run_start   = tuner_now();
+  uint64_t next_report = run_start + params.telemetry_period * 1000ull;
+
+  // Sends the controller each thread's progress, if a report is due. Only reads the counters each thread stores after 
+  // its chunks, so the threads are never held up. Reports which the controller is not keeping up with are dropped, 
+  // rather than wait for room in the shared memory ring or the ZMQ send queue.
+  auto report_progress = [&] ()
+  {
+    uint64_t now = tuner_now();
 
-    if (rc)
+    if (params.telemetry_period == 0 || now < next_report)
     {
-      // If we couldn't create a new thread, throw an error and exit.
-      print("[Main] ERROR; return code from pthread_create() is ", rc, "\n");
-      exit(-1);
+      return;
     }
-  }
 
-  // Get our PID to send to the controller.
-  uint32_t pid = pthread_self();
+    next_report = now + params.telemetry_period * 1000ull;
 
-  using namespace zmq;
+    struct telemetry telem;
 
-  //  Prepare our context and socket
-  context_t context(1);
-  socket_t  socket(context, ZMQ_PAIR);
+    telem.pid             = pid;
+    telem.tasks_remaining = bot.numTasksRemaining();
+    telem.elapsed_micros  = (now - run_start) / 1000;
 
-  socket.connect("tcp://localhost:5555");
+    telem.threads.resize(min<uint32_t>(bot.numThreads(), MAX_NUM_THREADS));
 
-  print("\n[Main] Registering with controller...\n\n");
+    for (uint32_t i = 0; i < telem.threads.size(); i++)
+    {
+      thread_progress &p = bot.progress[i].value;
+
+      telem.threads[i].tasks_done      = p.tasks_done.load(memory_order_relaxed);
+      telem.threads[i].work_micros     = p.work_nanos.load(memory_order_relaxed) / 1000;
+      telem.threads[i].overhead_micros = p.overhead_nanos.load(memory_order_relaxed) / 1000;
+    }
+
+    link.send(telem);
+  };
+
+  // With main_as_worker, the main thread runs thread 0 itself rather than handing it to the pool.
+  thread_data<body_t> *main_data = NULL;
+
+  // Start all our needed threads.
+  for (auto& data : thread_data_generations.back())
+  {
+    print("[Main] Starting thread ", data.threadId, "\n");
+
+    bot.thread_control[data.threadId].value = Execute;
+    bot.latest_data[data.threadId].value    = &data;
+
+    if (params.main_as_worker && data.threadId == 0)
+    {
+      main_data = &data;
+
+      continue;
+    }
+
+    pool.dispatch(data.threadId, data.cpu_affinity, mapArrayThread<body_t>, (void *) &data);
+  }
+
+  if (link.is_connected())
+  {
+    print("\n[Main] Registering with controller...\n\n");
+  }
+  else
+  {
+    print("\n[Main] No controller found, running without one\n\n");
+  }
         
   struct message rgstr;
 
-  rgstr.header                   = APP_REG;
-  rgstr.pid                      = pid;
-  rgstr.settings.schedule        = params.schedule;
+  rgstr.header                          = APP_REG;
+  rgstr.pid                             = pid;
+  rgstr.settings.schedule               = params.schedule;
+  rgstr.settings.thread_pinnings        = params.thread_pinnings;
+  rgstr.settings.task_size_distribution = params.task_size_distribution;
 
-  fill_n(rgstr.settings.thread_pinnings, MAX_NUM_THREADS, -1);
+  link.send(rgstr);
 
-  copy(params.thread_pinnings.begin(), params.thread_pinnings.end(), rgstr.settings.thread_pinnings);
+  // Follows a new schedule sent by the controller.
+  auto apply_update = [&] (const struct message &msg)
+  {
+    print("\n[Main] Received new parameters from controller!\n\n");
 
-  m_send(socket, rgstr);
+    // Read the new thread pinnings, up to as many threads as we can run.
+    deque<int> new_thread_pinnings = msg.settings.thread_pinnings;
 
-  while (bot.empty == false)
-  {
-    usleep(5);
+    if (new_thread_pinnings.size() > MAX_NUM_THREADS)
+    {
+      print("\n[Main] Only using the first ", MAX_NUM_THREADS, " of ", new_thread_pinnings.size(), " pinnings\n\n");
+
+      new_thread_pinnings.resize(MAX_NUM_THREADS);
+    }
 
-    // Get message from controller.
-    struct message msg = m_no_block_recv(socket);
+    stringstream thread_pinnings_stringstream;
 
-    if (msg.header != -1)
+    for (int cpu : new_thread_pinnings)
     {
-      print("\n[Main] Received new parameters from controller!\n\n");
+      thread_pinnings_stringstream << cpu << " ";
+    }
 
-      // Calculate new number of threads.
-      /*uint32_t new_num_threads = MAX_NUM_THREADS - count(begin(msg.settings.thread_pinnings), end(msg.settings.thread_pinnings), -1);
+    if (new_thread_pinnings.size() == 0)
+    {
+      print("\n[Main] No thread pinnings received, ignoring update!\n\n");
 
-      // If we have a surplus of threads;
-      if (params.thread_pinnings.size() > new_num_threads)
-      {
-        uint32_t iterator = bot.thread_control.size() - 1;
+      return;
+    }
 
-        // Set excess threads to terminate.
-        while(iterator > new_num_threads - 1)
-        {
-          bot.thread_control.at(iterator) = Terminate;
-        }
+    print("\n[Main] New schedule received!",
+          "\n[Main] Changing schedule to: ", Schedules[msg.settings.schedule], 
+          "\n[Main] With thread pinnings: ", thread_pinnings_stringstream.str(),
+          "\n\n");
 
-        // Join with terminating threads.
-        join_with_threads(threads, params.thread_pinnings.size() - new_num_threads);
+    uint32_t old_num_threads = params.thread_pinnings.size();
+    uint32_t new_num_threads = new_thread_pinnings.size();
 
-        // Cleanup thread control vars.
-        bot.thread_control.resize(new_num_threads);
-      }
-        
-      if (params.thread_pinnings.size() < new_num_threads)
+    // Update parameters.
+    params.schedule        = msg.settings.schedule;
+    params.thread_pinnings = new_thread_pinnings;
+
+    // Let any new threads take part in the bag. Tasks left by retiring threads will be stolen.
+    bot.resize(new_num_threads);
+
+    // Data stays where it was placed, but thieves follow the threads' new nodes.
+    if (params.numa_aware)
+    {
+      place_numa_regions(bot, params, regions, false);
+    }
+
+    // Calculate new info for data partitioning.
+    thread_data_generations.push_back(calc_thread_data(bot.numTasksRemaining(), bot, params));
+
+    // Resize the team live, without stopping any thread.
+    for (auto& data : thread_data_generations.back())
+    {
+      bot.latest_data[data.threadId].value = &data;
+
+      if (data.threadId < (int) old_num_threads)
       {
+        // Running threads pick up their new instructions after their current chunk.
+        Thread_Control expected = Execute;
 
-      }*/
+        bot.thread_control[data.threadId].value.compare_exchange_strong(expected, Update);
+      }
+      else
+      {
+        // New threads join the running ones, once any earlier job on their pool thread has retired.
+        print("[Main] Starting thread ", data.threadId, "\n");
 
-      // Terminating threads.
-      bot.thread_control.assign(params.thread_pinnings.size(), Terminate);
+        pool.wait(data.threadId);
 
-      // Joining with threads.
-      join_with_threads(threads, params.thread_pinnings.size());
+        bot.thread_control[data.threadId].value = Execute;
 
-      // Update parameters.
-      params.schedule = msg.settings.schedule;
+        pool.dispatch(data.threadId, data.cpu_affinity, mapArrayThread<body_t>, (void *) &data);
+      }
+    }
 
-      // Clear previous thread pinnings.
-      params.thread_pinnings.clear();
+    // Surplus threads finish their current chunk and retire.
+    for (uint32_t i = new_num_threads; i < old_num_threads; i++)
+    {
+      bot.thread_control[i].value = Terminate;
+    }
+  };
 
-      uint32_t i_w = 0;
-      stringstream thread_pinnings_stringstream;
+  if (main_data != NULL)
+  {
+    // Run thread 0 here, checking for new instructions between its chunks. Thread 0 only returns once the bag is 
+    // empty, after which the controller is no longer listened to, as below.
+    bot.between_chunks = [&] ()
+    {
+      struct message msg = link.try_recv();
 
-      while (msg.settings.thread_pinnings[i_w] != -1) 
+      if (msg.header != -1)
       {
-        // Record and update thread pinnings.
-        thread_pinnings_stringstream << msg.settings.thread_pinnings[i_w] << " ";
-        params.thread_pinnings.push_back(msg.settings.thread_pinnings[i_w]);
-        i_w++;
+        apply_update(msg);
       }
 
-      print("\n[Main] New schedule received!",
-            "\n[Main] Changing schedule to: ", Schedules[msg.settings.schedule], 
-            "\n[Main] With thread pinnings: ", thread_pinnings_stringstream.str(),
-            "\n\n");
+      report_progress();
+    };
 
-      // Restart map_array:
+    // Take thread 0's pinning while we run it, and put our own back afterwards.
+    cpu_set_t old_affinity;
 
-      // Reset terminate variables.
-      bot.thread_control.assign(params.thread_pinnings.size(), Execute);
-        
-      // Recalculate info for data partitioning.
-      thread_data_deque = calc_thread_data(bot.numTasksRemaining(), bot, params);
+    pthread_getaffinity_np(pthread_self(), sizeof(old_affinity), &old_affinity);
 
-      // Reset thread ids.
-      threads.clear();
-      threads.resize(params.thread_pinnings.size());
+    pin_this_worker(main_data->cpu_affinity);
 
-      // Create all our needed threads.
-      for (uint32_t i = 0; i < params.thread_pinnings.size(); i++)
+    mapArrayThread<body_t>((void *) main_data);
+
+    pthread_setaffinity_np(pthread_self(), sizeof(old_affinity), &old_affinity);
+  }
+  else
+  {
+    // Sleep until the controller sends something, the bag runs dry, or the next report is due.
+    while (link.is_connected() && bot.empty == false)
+    {
+      int64_t timeout_us = -1;
+
+      if (params.telemetry_period != 0)
       {
-        print("[Main] Creating thread ", i , "\n");
+        uint64_t now = tuner_now();
+
+        timeout_us = (now < next_report) ? (next_report - now + 999) / 1000 : 0;
+      }
 
-        int rc = pthread_create(&threads.at(i), NULL, mapArrayThread<in1, in2, out>, (void *) &thread_data_deque.at(i));
+      struct message msg = link.wait(timeout_us);
 
-        if (rc)
-        {
-          // If we couldn't create a new thread, throw an error and exit.
-          print("[Main] ERROR; return code from pthread_create() is ", rc, "\n");
-          exit(-1);
-        }
+      if (msg.header != -1)
+      {
+        apply_update(msg);
       }
+
+      report_progress();
     }
   }
 
@@ -214,11 +404,9 @@ void map_array(deque<in1>& input1, deque<in2>& input2, out (*user_function) (in1
   term.header = APP_TERM;
   term.pid = pid;
 
-  m_send(socket, term);
+  link.send(term);
 
-  socket.close();
-
-  join_with_threads(threads, params.thread_pinnings.size());
+  pool.wait();
 
   Ms(metrics_finalise());
 
@@ -229,4 +417,171 @@ void map_array(deque<in1>& input1, deque<in2>& input2, out (*user_function) (in1
   return;
 }
 
+
+
+/*
+ *  Batch form of the mapArray pattern. Rather than calling a user function per element, the scheduler hands each whole 
+ *  chunk to the user's kernel, which runs over a contiguous sub-range of the input and output arrays. Kernels written 
+ *  as a simple loop over count elements can then be vectorised by the compiler.
+ *
+ *  const in1*   input1        - Input array to be iterated over.
+ *  size_t       size          - Number of elements in input1, and in output.
+ *  K            kernel        - Any callable taking (const in1* in, out* out, size_t count), which must fill 
+ *                               out[0, count) from in[0, count).
+ *  out*         output        - Array to store output in, at least size elements long.
+ */
+
+template <typename in1, typename out, typename K>
+void map_array_batch(const in1 *input1, size_t size, K kernel, out *output, 
+                     string output_filename = "", parameters params = parameters())
+{
+  auto body = [&] (uint32_t thread_id, uint32_t begin, uint32_t end)
+  {
+    (void) thread_id;
+
+    Ms(metrics_starting_work(thread_id));
+
+    kernel(input1 + begin, output + begin, (size_t) (end - begin));
+
+    Ms(metrics_finishing_work(thread_id));
+  };
+
+  // Keep chunks of output on separate cache lines.
+  uint32_t grain, lead;
+
+  output_alignment(output, grain, lead);
+
+  deque<numa_region> regions = {{input1, sizeof(in1)}, {output, sizeof(out)}};
+
+  run_map_array((uint32_t) size, body, output_filename, params, grain, lead, regions);
+}
+
+
+
+/*
+ *  Implementation of the mapArray parallel programming pattern over contiguous arrays. Splits the tasks according to 
+ *  params, and writes output[i] = user_function(input1[i], input2) for every i in [0, size). A thin adapter over 
+ *  map_array_batch.
+ *
+ *  const in1*   input1        - First input array to be iterated over.
+ *  size_t       size          - Number of elements in input1, and in output.
+ *  const in2&   input2        - Shared second input, passed by reference to every call of the user function.
+ *  F            user_function - Any callable (function, lambda, functor) taking (const in1&, const in2&) and 
+ *                               returning an out. Taken as a template parameter so calls can be inlined.
+ *  out*         output        - Array to store output in, at least size elements long.
+ */
+
+template <typename in1, typename in2, typename out, typename F>
+void map_array(const in1 *input1, size_t size, const in2& input2, F user_function, out *output, 
+               string output_filename = "", parameters params = parameters())
+{
+  auto kernel = [&] (const in1 *in, out *res, size_t count)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      res[i] = user_function(in[i], input2);
+    }
+  };
+
+  map_array_batch(input1, size, kernel, output, output_filename, params);
+}
+
+
+
+/*
+ *  As above, over vectors. If the output vector is not big enough, it will be resized.
+ */
+
+template <typename in1, typename in2, typename out, typename F>
+void map_array(const vector<in1>& input1, const in2& input2, F user_function, vector<out>& output, 
+               string output_filename = "", parameters params = parameters())
+{
+  if (output.size() < input1.size())
+  {
+    output.resize(input1.size());
+  }
+
+  map_array(input1.data(), input1.size(), input2, user_function, output.data(), output_filename, params);
+}
+
+
+
+/*
+ *  Original deque interface. If the output deque is not big enough, it will be resized.
+ *
+ *  deque<in1>& input1                              - First input deque to be iterated over.
+ *  deque<in2>& input2                              - Second input deque to be passed to user function.
+ *  out          (*user_function) (in1, deque<in2>) - User function pointer to a function which takes .
+ *                                                     (in1, deque<in2>) and returns an out type.
+ *  deque<out>& output                              - deque to store output in.
+ *
+ *  Deques are not contiguous, so this indexes input1 directly rather than using the array overload. Each block of a 
+ *  deque is allocated separately, and its lines do not line up with the other blocks', so threads write their output 
+ *  into a contiguous buffer aligned to a cache line, which is moved into the output deque at the end. The user 
+ *  function still takes input2 by value, so prefer the overloads above in new code.
+ */
+
+template <typename in1, typename in2, typename out>
+void map_array(deque<in1>& input1, deque<in2>& input2, out (*user_function) (in1, deque<in2>), deque<out>& output, 
+               string output_filename = "", parameters params = parameters())
+{
+  if (output.size() < input1.size())
+  {
+    output.resize(input1.size());
+  }
+
+  size_t size = input1.size();
+
+  // Contiguous output, starting on a cache line.
+  void *memory = NULL;
+
+  if (posix_memalign(&memory, CACHE_LINE_SIZE, max<size_t>(size, 1) * sizeof(out)) != 0)
+  {
+    throw bad_alloc();
+  }
+
+  out *staging = static_cast<out*>(memory);
+
+  for (size_t i = 0; i < size; i++)
+  {
+    new (staging + i) out();
+  }
+
+  // Keep chunks of output on separate cache lines.
+  uint32_t grain, lead;
+
+  output_alignment(staging, grain, lead);
+
+  auto body = [&] (uint32_t thread_id, uint32_t begin, uint32_t end)
+  {
+    (void) thread_id;
+
+    // Chunks which do not end at either end of the output must end on a cache line.
+    assert(begin == 0 || (uintptr_t) (staging + begin) % CACHE_LINE_SIZE == 0);
+    assert(end == size || (uintptr_t) (staging + end) % CACHE_LINE_SIZE == 0);
+
+    typename deque<in1>::iterator in1It = input1.begin() + begin;
+
+    for (uint32_t i = begin; i < end; i++, ++in1It)
+    {
+      Ms(metrics_starting_work(thread_id));
+
+      staging[i] = user_function(*in1It, input2);
+
+      Ms(metrics_finishing_work(thread_id));
+    }
+  };
+
+  run_map_array((uint32_t) size, body, output_filename, params, grain, lead);
+
+  move(staging, staging + size, output.begin());
+
+  for (size_t i = 0; i < size; i++)
+  {
+    staging[i].~out();
+  }
+
+  free(memory);
+}
+
 #endif // MAP_ARRAY_HPP
\ No newline at end of file
@@ -10,9 +10,14 @@
 #include <boost/thread.hpp> // boost::thread::hardware_concurrency();
 #include <string>
 #include <iostream>
+#include <functional>
 
 #include <utils.hpp>
 #include <comms.hpp>
+#include <range_deque.hpp>
+#include <chunk_tuner.hpp>
+#include <thread_pool.hpp>
+#include <numa_utils.hpp>
 
 using namespace std;
 
@@ -36,7 +41,8 @@ using namespace std;
 // Parameters with default values.
 struct parameters 
 {
-    parameters(): task_dist(1), schedule(Tapered) 
+    parameters(): task_dist(1), schedule(Tapered), auto_overhead(0.01), numa_aware(false), transport(Shm_transport), 
+                 main_as_worker(false), telemetry_period(10000) 
     { 
       // Retrieve the number of CPUs using the boost library.
       uint32_t num_threads = boost::thread::hardware_concurrency();
@@ -55,6 +61,25 @@ struct parameters
 
     // Schedule to use.
     Schedule schedule;
+
+    // Fraction of time the Auto schedule aims to spend getting tasks, relative to time spent executing them.
+    double auto_overhead;
+
+    // Place each thread's share of the input and output on the NUMA node it is pinned to.
+    bool numa_aware;
+
+    // How to reach the controller. Must match the transport the controller was started with.
+    Transport transport;
+
+    // Run thread 0 on the calling thread, which checks for controller messages between its chunks, rather than keep a 
+    // thread waiting on the controller.
+    bool main_as_worker;
+
+    // Microseconds between telemetry reports to the controller, or 0 to send none.
+    uint32_t telemetry_period;
+
+    // Relative cost of the tasks across the input, if known, passed on to the controller. See struct settings.
+    deque<uint32_t> task_size_distribution;
 };
 
 
@@ -88,6 +113,7 @@ deque<uint32_t> calc_schedules(uint32_t num_tasks, uint32_t num_threads, Schedul
       break;
 
     case Dynamic_chunks:
+    case Dynamic_atomic:
       {
         if (chunk_size == 0)
         {
@@ -127,7 +153,21 @@ deque<uint32_t> calc_schedules(uint32_t num_tasks, uint32_t num_threads, Schedul
 
     case Auto:
       {
-        print("\n\n\n*********************\n\nAuto schedule not implemented yet!\n\n*********************\n\n\n\n");
+        // Start small, each thread's tuner grows its chunk size once it has measured the cost of its tasks.
+        if (chunk_size == 0)
+        {
+          chunk_size = num_tasks / (num_threads * 100);
+        }
+
+        if (chunk_size == 0)
+        {
+          chunk_size = 1;
+        }
+
+        for (uint32_t i = 0; i < num_threads; i++)
+        {
+          output.at(i) = chunk_size;
+        }
       }
 
       break;
@@ -143,143 +183,361 @@ enum Thread_Control {Execute, Update, Terminate};
 
 
 
-// Structure to contain a group of tasks.
-template <typename in1, typename in2, typename out>
+// Structure to contain a group of tasks, as a range of task indices [begin, end).
 struct tasks
 {
-  // Start of input.
-  typename deque<in1>::iterator in1Begin;
+  // First task.
+  uint32_t begin;
+
+  // One past the last task.
+  uint32_t end;
+};
+
+
+
+template <typename body_t>
+struct thread_data;
+
+
+
+// Wraps a value shared between threads, padding it so it never shares a cache line with its neighbours.
+template <typename T>
+struct alignas(PADDED_SIZE) padded
+{
+  T value;
+};
 
-  // End of input.
-  typename deque<in1>::iterator in1End;
 
-  // Pointer to shared input2 deque.
-  deque<in2>* input2;
 
-  // User function pointer.
-  out (*userFunction) (in1, deque<in2>);
+// Running totals of one thread's progress, reported to the controller. Only ever written by their own thread.
+struct thread_progress
+{
+  // Tasks run.
+  atomic<uint64_t> tasks_done;
 
-  // Start of output.
-  typename deque<out>::iterator outBegin;
+  // Time spent running tasks, and time spent between them getting more, in nanoseconds.
+  atomic<uint64_t> work_nanos;
+  atomic<uint64_t> overhead_nanos;
 };
 
 
 
-// Bag of tasks class. Also contains shard variables for communicating with worker threads.
-template <class in1, class in2, class out>
+// Bag of tasks class. Also contains shared variables for communicating with worker threads. Tasks are split into one
+// range per worker, which the worker works through in chunks. When its own range runs dry, a worker steals half of the
+// largest remaining range, so no global lock is taken when handing out tasks. The Dynamic_atomic schedule instead 
+// leaves all tasks behind a single shared cursor, which threads advance by one chunk at a time.
+//
+// The bag only deals in task indices. Threads pass each chunk of indices to the shared body, a callable which runs 
+// body(thread_id, begin, end) over the tasks [begin, end), so the user's work can be inlined into the thread loop.
+//
+// Tasks are handed out in whole blocks of grain tasks, the first block being shortened by lead tasks. Chosen so that 
+// block boundaries fall on cache line boundaries of the output, no two threads then ever write to the same line.
+//
+// Each thread is tagged with the NUMA node it runs on. Thieves prefer victims on their own node, and only cross to 
+// another node once their node has run out of tasks, so tasks mostly run next to the memory placed for them.
+template <class body_t>
 class BagOfTasks {
   public:
-    // Variables to control if threads terminate.
-    deque<Thread_Control> thread_control;
+    // Variables to control if threads terminate, or pick up new instructions.
+    padded<atomic<Thread_Control>> thread_control[MAX_NUM_THREADS];
+
+    // Latest instructions for each thread, read when its control variable is set to Update.
+    padded<atomic<thread_data<body_t>*>> latest_data[MAX_NUM_THREADS];
 
     // Check for if bag is empty.
-    bool empty = false;
+    atomic<bool> empty;
+
+    // Body to run over each chunk of tasks.
+    body_t *body;
+
+    // Called once, by the thread which finds the bag empty. Set before any thread starts.
+    function<void()> on_empty;
+
+    // Called by thread 0 between its chunks, when the main thread runs it.
+    function<void()> between_chunks;
+
+    // Progress of each thread, read by the main thread for telemetry.
+    padded<thread_progress> progress[MAX_NUM_THREADS];
 
     // Constructor
-    BagOfTasks(typename deque<in1>::iterator in1B, 
-               typename deque<in1>::iterator in1E, 
-               deque<in2>* in2p, 
-               out (*userF) (in1, deque<in2>), 
-               typename deque<out>::iterator outB) :
+    BagOfTasks(uint32_t num_tasks, body_t *b, uint32_t grain = 1, uint32_t lead = 0) :
               
-               in1Begin(in1B),
-               in1End(in1E),
-               input2(in2p),
-               userFunction(userF),
-               outBegin(outB)
-      {}
+               empty(false),
+               body(b),
+               numTasks(num_tasks),
+               taskGrain(grain > 0 ? grain : 1),
+               taskLead(lead % (grain > 0 ? grain : 1)),
+               numRanges(0)
+      {
+        numBlocks = ((uint64_t) numTasks + taskLead + taskGrain - 1) / taskGrain;
+
+        for (uint32_t i = 0; i < MAX_NUM_THREADS; i++)
+        {
+          progress[i].value.tasks_done     = 0;
+          progress[i].value.work_nanos     = 0;
+          progress[i].value.overhead_nanos = 0;
+        }
+      }
 
     // Destructor
     ~BagOfTasks() {};
 
     // Overloads << operator for easy printing with streams.
-    friend ostream& operator<< (ostream &outS, BagOfTasks<in1, in2, out> &bot)
+    friend ostream& operator<< (ostream &outS, BagOfTasks<body_t> &bot)
     {
-      // Get mutex. When control leaves the scope in which the lock_guard object was created, the lock_guard is 
-      // destroyed and the mutex is released. 
-      lock_guard<mutex> lock(bot.m);
-
       // Print all our important data.
       return outS << "Bag of tasks: " << endl
-                  << "Data types - <" << type_name<in1>() << ", " 
-                                      << type_name<in2>() << ", " 
-                                      << type_name<out>() << ">" << endl
-                  << "Number of tasks - " << bot.in1End - bot.in1Begin << endl << endl;
+                  << "Body type - <" << type_name<body_t>() << ">" << endl
+                  << "Number of tasks - " << bot.numTasksRemaining() << endl << endl;
     };
 
-    uint32_t numTasksRemaining()
+    // Splits all tasks evenly between the ranges of the given number of threads, or places them all behind the shared 
+    // cursor for the Dynamic_atomic schedule. Must be called before any threads start taking tasks.
+    void seed(uint32_t num_threads, Schedule sched)
     {
-      // Get mutex. 
-      lock_guard<mutex> lock(m);
+      numRanges = num_threads;
+
+      for (uint32_t i = 0; i < num_threads; i++)
+      {
+        node[i] = 0;
+      }
+
+      if (sched == Dynamic_atomic)
+      {
+        cursor.value = 0;
+
+        return;
+      }
+
+      cursor.value = numBlocks;
 
-      // Return value.
-      return in1End - in1Begin;
+      deque<uint32_t> shares = calc_schedules(numBlocks, num_threads, Static);
+
+      uint32_t begin = 0;
+
+      for (uint32_t i = 0; i < num_threads; i++)
+      {
+        ranges[i].reset(begin, begin + shares.at(i));
+
+        begin += shares.at(i);
+      }
     }
 
-    // Returns tasks of the specified number or less. 
-    tasks<in1, in2, out> getTasks(uint32_t num)
+    // Changes the number of threads taking tasks. Safe to call while threads are running, but only from the main 
+    // thread. New threads start with an empty range and steal their first tasks. Ranges left over by threads which 
+    // have retired are kept, and will be stolen by the remaining threads. Tasks still behind the shared cursor keep 
+    // being handed out from it, whatever the new schedule.
+    void resize(uint32_t num_threads)
     {
-      // Get mutex. 
-      lock_guard<mutex> lock(m);
+      if (num_threads > numRanges.load())
+      {
+        numRanges = num_threads;
+      }
+    }
 
-      // Record where we should start in our task list.
-      typename deque<in1>::iterator tasksBegin = in1Begin;
+    // Returns the tasks the given thread is first given by seed, out of num_threads. Used to place each thread's data 
+    // near it before the threads start.
+    tasks staticShare(uint32_t thread_id, uint32_t num_threads)
+    {
+      deque<uint32_t> shares = calc_schedules(numBlocks, num_threads, Static);
 
-      uint32_t num_tasks;
+      uint32_t begin = 0;
 
-      // Calculate number of tasks to return.
-      if (num < in1End - in1Begin)
+      for (uint32_t i = 0; i < thread_id; i++)
       {
-        num_tasks = num;
+        begin += shares.at(i);
       }
-      else
+
+      return makeTasks(begin, begin + shares.at(thread_id));
+    }
+
+    // Adds a chunk to the given thread's progress. Only called by that thread, so needs no atomic read-modify-write, 
+    // only stores the main thread can read while it runs.
+    void recordProgress(uint32_t thread_id, uint32_t num_tasks, uint64_t work_nanos, uint64_t overhead_nanos)
+    {
+      thread_progress &p = progress[thread_id].value;
+
+      p.tasks_done.store(p.tasks_done.load(memory_order_relaxed) + num_tasks, memory_order_relaxed);
+      p.work_nanos.store(p.work_nanos.load(memory_order_relaxed) + work_nanos, memory_order_relaxed);
+      p.overhead_nanos.store(p.overhead_nanos.load(memory_order_relaxed) + overhead_nanos, memory_order_relaxed);
+    }
+
+    // Returns the number of threads which have taken part in the bag, including any which have since retired.
+    uint32_t numThreads()
+    {
+      return numRanges.load();
+    }
+
+    // Records the NUMA node the given thread runs on, which steal prefers. Safe to call while threads are running.
+    void setNode(uint32_t thread_id, int numa_node)
+    {
+      node[thread_id].store(numa_node, memory_order_relaxed);
+    }
+
+    uint32_t numTasksRemaining()
+    {
+      size_t   claimed   = cursor.value.load();
+      uint32_t remaining = (claimed < numBlocks) ? numBlocks - claimed : 0;
+
+      for (uint32_t i = 0; i < numRanges.load(); i++)
       {
-        num_tasks = in1End - in1Begin;
+        remaining += ranges[i].size();
       }
 
-      if (num_tasks == 0)
+      return blocksToTasks(remaining);
+    }
+
+    // Returns an estimate of the tasks the given thread has left to do, without touching any other thread's range.
+    uint32_t tasksLeftFor(uint32_t thread_id)
+    {
+      size_t   claimed = cursor.value.load(memory_order_relaxed);
+      uint32_t shared  = (claimed < numBlocks) ? (numBlocks - claimed) / numRanges.load(memory_order_relaxed) : 0;
+
+      return blocksToTasks(ranges[thread_id].size() + shared);
+    }
+
+    // Returns about the specified number of tasks for the given thread, rounded up to whole blocks. Returns no tasks 
+    // only once every range is empty.
+    tasks getTasks(uint32_t thread_id, uint32_t num)
+    {
+      uint32_t begin = 0;
+      uint32_t end   = 0;
+
+      // Work in whole blocks, and always make progress, even with a zero chunk size.
+      num = (num + taskGrain - 1) / taskGrain;
+
+      if (num == 0)
       {
-        empty = true;
+        num = 1;
+      }
+
+      // Claim a chunk from the shared cursor while it has tasks left. Otherwise take from our own range, stealing a new 
+      // one whenever it runs dry.
+      if (cursor.value.load(memory_order_relaxed) < numBlocks)
+      {
+        size_t claimed = cursor.value.fetch_add(num, memory_order_relaxed);
+
+        if (claimed < numBlocks)
+        {
+          begin = claimed;
+          end   = (claimed + num < numBlocks) ? claimed + num : numBlocks;
+
+          return makeTasks(begin, end);
+        }
       }
 
-      // Advance our iterator so it now marks the end of our tasks.
-      advance(in1Begin, num_tasks);
+      while (!ranges[thread_id].take(num, begin, end))
+      {
+        if (!steal(thread_id, begin, end))
+        {
+          if (!empty.exchange(true) && on_empty)
+          {
+            on_empty();
+          }
 
-      // Create tasks data structure to return.
-      struct tasks<in1, in2, out> output = {
-        tasksBegin, 
-        in1Begin,
-        input2,
-        userFunction,
-        outBegin
-      };
+          break;
+        }
 
-      // Advance the output iterator to output in the correct place next time.
-      advance(outBegin, num_tasks);
+        ranges[thread_id].reset(begin, end);
+      }
 
-      return output;
+      return makeTasks(begin, end);
     };
 
   private:
-    mutex m;
+    // Converts a range of blocks to the range of tasks they hold.
+    tasks makeTasks(uint32_t begin, uint32_t end)
+    {
+      return {blockStart(begin), blockStart(end)};
+    }
+
+    // Returns the first task of the given block, or numTasks for the block past the end.
+    uint32_t blockStart(uint32_t block)
+    {
+      uint64_t task = (uint64_t) block * taskGrain;
+
+      task = (task > taskLead) ? task - taskLead : 0;
+
+      return (task < numTasks) ? task : numTasks;
+    }
+
+    // Returns an upper bound on the tasks held in the given number of blocks.
+    uint32_t blocksToTasks(uint32_t blocks)
+    {
+      uint64_t tasks = (uint64_t) blocks * taskGrain;
+
+      return (tasks < numTasks) ? tasks : numTasks;
+    }
 
-    typename deque<in1>::iterator in1Begin;
-    typename deque<in1>::iterator in1End;
+    // Steals half of the largest range belonging to another thread, preferring threads on our own NUMA node. Returns 
+    // false if there is nothing left to steal.
+    bool steal(uint32_t thread_id, uint32_t &begin, uint32_t &end)
+    {
+      int my_node = node[thread_id].load(memory_order_relaxed);
 
-    deque<in2>* input2;
+      while (true)
+      {
+        uint32_t num_ranges = numRanges.load(memory_order_acquire);
+        uint32_t victim     = thread_id;
+        uint32_t largest    = 0;
+        bool     local      = false;
+
+        // Look for the victim with the most remaining tasks, starting after ourselves so thieves spread out. Any victim 
+        // on our node beats every victim on another node.
+        for (uint32_t i = 1; i < num_ranges; i++)
+        {
+          uint32_t candidate = (thread_id + i) % num_ranges;
+          uint32_t size      = ranges[candidate].size();
+          bool     same_node = node[candidate].load(memory_order_relaxed) == my_node;
+
+          if (size > 0 && ((same_node && !local) || (same_node == local && size > largest)))
+          {
+            victim  = candidate;
+            largest = size;
+            local   = same_node;
+          }
+        }
 
-    out (*userFunction) (in1, deque<in2>);
+        if (largest == 0)
+        {
+          return false;
+        }
 
-    typename deque<out>::iterator outBegin;
+        if (ranges[victim].steal(begin, end))
+        {
+          return true;
+        }
+      }
+    }
+
+    uint32_t numTasks;
+
+    // Number of tasks per block, and number of tasks missing from the front of the first block.
+    uint32_t taskGrain;
+    uint32_t taskLead;
+
+    uint32_t numBlocks;
+
+    // One range of block indices per thread.
+    RangeDeque ranges[MAX_NUM_THREADS];
+
+    // Number of ranges in use.
+    atomic<uint32_t> numRanges;
+
+    // Index of the next unclaimed block behind the shared cursor.
+    padded<atomic<size_t>> cursor;
+
+    // NUMA node of each thread.
+    atomic<int> node[MAX_NUM_THREADS];
 };
 
 
 
 enum Status {Alive, Sleeping, Terminated};
 
-// Data struct to pass to each thread.
-template <typename in1, typename in2, typename out>
-struct thread_data
+// Data struct to pass to each thread. Aligned like padded<>, so each thread's data has its own cache lines.
+template <typename body_t>
+struct alignas(PADDED_SIZE) thread_data
 {
   // Id of this thread.
   int threadId;
@@ -293,8 +551,14 @@ struct thread_data
   // Check for tapered schedule.
   bool tapered_schedule = false;
 
+  // Check for auto schedule.
+  bool auto_schedule = false;
+
+  // Target overhead for the auto schedule's chunk size tuner.
+  double auto_overhead = 0.01;
+
   // Pointer to the shared bag of tasks object.
-  BagOfTasks<in1, in2, out> *bot;
+  BagOfTasks<body_t> *bot;
 
   // Flag which main thread will set to indicate new instructions.
   bool check_for_new_instructions = false;
@@ -304,19 +568,19 @@ struct thread_data
 
 
 
-template <typename in1, typename in2, typename out>
-deque<thread_data<in1, in2, out>> calc_thread_data(uint32_t input1_size, BagOfTasks<in1, in2, out> &bot, parameters params) 
+template <typename body_t>
+deque<thread_data<body_t>> calc_thread_data(uint32_t input1_size, BagOfTasks<body_t> &bot, parameters params) 
 {
   // Calculate info for data partitioning.
   deque<uint32_t> schedules = calc_schedules(input1_size, params.thread_pinnings.size(), params.schedule);
 
   // Output thread data
-  deque<thread_data<in1, in2, out>> output;
+  deque<thread_data<body_t>> output;
 
   // Set thread data values.
   for (uint32_t i = 0; i < params.thread_pinnings.size(); i++)
   {
-    struct thread_data<in1, in2, out> iter_data;
+    struct thread_data<body_t> iter_data;
 
     iter_data.threadId     = i;
     iter_data.chunk_size   = schedules.at(i);
@@ -328,6 +592,12 @@ deque<thread_data<in1, in2, out>> calc_thread_data(uint32_t input1_size, BagOfTa
       iter_data.tapered_schedule = true;
     }
 
+    if (params.schedule == Auto)
+    {
+      iter_data.auto_schedule = true;
+      iter_data.auto_overhead = params.auto_overhead;
+    }
+
     output.push_front(iter_data);
   }
 
@@ -336,15 +606,15 @@ deque<thread_data<in1, in2, out>> calc_thread_data(uint32_t input1_size, BagOfTa
 
 
 
-// Function to start each thread of mapArray on.
-template <typename in1, typename in2, typename out>
+// Function to run on each thread of mapArray. Runs as a job on a pool thread, which has already been pinned to 
+// cpu_affinity. Between chunks the thread checks its control variable, picking up new instructions on Update and 
+// retiring on Terminate.
+template <typename body_t>
 void *mapArrayThread(void *threadarg)
 {
   // Pointer to store personal data
-  struct thread_data<in1, in2, out> *my_data;
-  my_data = (struct thread_data<in1, in2, out> *) threadarg;
-
-  stick_this_thread_to_cpu(my_data->cpu_affinity);
+  struct thread_data<body_t> *my_data;
+  my_data = (struct thread_data<body_t> *) threadarg;
 
   // Initialise metrics
   Ms(metrics_thread_start(my_data->threadId));
@@ -353,30 +623,70 @@ void *mapArrayThread(void *threadarg)
   print("[Thread ", my_data->threadId, "] Hello! \n");
 
   // Get tasks
-  tasks<in1, in2, out> my_tasks = (*my_data->bot).getTasks(my_data->chunk_size);
+  tasks my_tasks = (*my_data->bot).getTasks(my_data->threadId, my_data->chunk_size);
 
   uint32_t tapered_chunk_size = my_data->chunk_size / 2;
 
+  // Chunk size tuner for the auto schedule.
+  ChunkTuner tuner(my_data->chunk_size, my_data->auto_overhead);
+
   // While we have tasks to do;
-  while (my_tasks.in1End - my_tasks.in1Begin > 0 )
+  while (my_tasks.end - my_tasks.begin > 0 )
   {
-    // Run between iterator ranges, stepping through input1 and output vectors
-    for (; my_tasks.in1Begin != my_tasks.in1End; ++my_tasks.in1Begin, ++my_tasks.outBegin)
+    uint32_t num_tasks  = my_tasks.end - my_tasks.begin;
+    uint64_t work_start = tuner_now();
+
+    // Run the body over our chunk of tasks.
+    (*(*my_data->bot).body)(my_data->threadId, my_tasks.begin, my_tasks.end);
+
+    uint64_t work_finish = tuner_now();
+
+    // Check for new instructions ourselves, if we are the main thread.
+    if (my_data->threadId == 0 && (*my_data->bot).between_chunks)
     {
-      Ms(metrics_starting_work(my_data->threadId));
-    
-      // Run user function
-      *(my_tasks.outBegin) = my_tasks.userFunction(*(my_tasks.in1Begin), *(my_tasks.input2));
+      (*my_data->bot).between_chunks();
+    }
+
+    Thread_Control control = (*my_data->bot).thread_control[my_data->threadId].value.load();
+
+    // Pick up new instructions from the main thread. Acknowledge first, so an update posted while we read this one is 
+    // not lost. If the acknowledgement fails we have been told to terminate instead.
+    if (control == Update)
+    {
+      (*my_data->bot).thread_control[my_data->threadId].value.compare_exchange_strong(control, Execute);
+
+      control = (control == Update) ? Execute : control;
+
+      uint32_t old_cpu = my_data->cpu_affinity;
+
+      my_data = (*my_data->bot).latest_data[my_data->threadId].value.load();
+
+      if (my_data->cpu_affinity != old_cpu)
+      {
+        pin_this_worker(my_data->cpu_affinity);
+      }
 
-      Ms(metrics_finishing_work(my_data->threadId));
+      tapered_chunk_size = my_data->chunk_size / 2;
+
+      tuner = ChunkTuner(my_data->chunk_size, my_data->auto_overhead);
+
+      print("[Thread ", my_data->threadId, "] New instructions received\n");
     }
 
     // If we should still be executing, get more tasks!
-    if ((*my_data->bot).thread_control.at(my_data->threadId) == Execute)
+    if (control == Execute)
     {
-      if (my_data->tapered_schedule)
+      if (my_data->auto_schedule)
+      {
+        my_tasks = (*my_data->bot).getTasks(my_data->threadId, tuner.chunkSize());
+
+        // Retune using how long the last chunk took, and how long we just waited for this one.
+        tuner.update(work_finish - work_start, tuner_now() - work_finish, num_tasks, 
+                     (*my_data->bot).tasksLeftFor(my_data->threadId));
+      }
+      else if (my_data->tapered_schedule)
       {
-        my_tasks = (*my_data->bot).getTasks(tapered_chunk_size);
+        my_tasks = (*my_data->bot).getTasks(my_data->threadId, tapered_chunk_size);
 
         print("[Thread ", my_data->threadId, "] Chunk size: ", tapered_chunk_size, "\n");
 
@@ -387,17 +697,25 @@ void *mapArrayThread(void *threadarg)
       }
       else
       {
-        my_tasks = (*my_data->bot).getTasks(my_data->chunk_size);
+        my_tasks = (*my_data->bot).getTasks(my_data->threadId, my_data->chunk_size);
 
         print("[Thread ", my_data->threadId, "] Chunk size: ", my_data->chunk_size, "\n");
       }
+
+      (*my_data->bot).recordProgress(my_data->threadId, num_tasks, work_finish - work_start, tuner_now() - work_finish);
     }
+    else
+    {
+      // We have been told to terminate, and our last chunk is done.
+      (*my_data->bot).recordProgress(my_data->threadId, num_tasks, work_finish - work_start, 0);
 
+      break;
+    }
   }
 
   Ms(metrics_thread_finished(my_data->threadId));
 
-  pthread_exit(NULL);
+  return NULL;
 }
 
 #endif // MAP_ARRAY_THREAD_HPP
\ No newline at end of file
@@ -0,0 +1,108 @@
+#ifndef RANGE_DEQUE_HPP
+#define RANGE_DEQUE_HPP
+
+#include <stdint.h>
+#include <atomic>           // Atomic range word
+
+using namespace std;
+
+// Size of a cache line, used to keep per-thread structures from sharing lines.
+#define CACHE_LINE_SIZE 64
+
+// Alignment of data written by one thread and read by others. Two lines, as adjacent line prefetchers fetch lines in 
+// pairs, which would otherwise still bounce a neighbour's line between cores.
+#define PADDED_SIZE (2 * CACHE_LINE_SIZE)
+
+
+
+/*
+ * A single worker's share of the bag of tasks, held as a contiguous range of task indices [begin, end). Both ends are
+ * packed into one 64 bit word, so the owning worker can take chunks from the front while idle workers steal from the
+ * back, each with a single compare-and-swap and without any lock. Task indices are never handed out twice during a
+ * run, so a stale compare-and-swap can never succeed against a recycled range.
+ */
+
+class alignas(PADDED_SIZE) RangeDeque {
+  public:
+    // Constructor
+    RangeDeque() : range(pack(0, 0)) {}
+
+    // Replace the range. Only the owner may call this, and only while its range is empty.
+    void reset(uint32_t begin, uint32_t end)
+    {
+      range.store(pack(begin, end), memory_order_release);
+    }
+
+    // Returns the number of tasks left in the range.
+    uint32_t size() const
+    {
+      uint64_t r = range.load(memory_order_acquire);
+
+      return unpack_end(r) - unpack_begin(r);
+    }
+
+    // Owner side. Takes up to num tasks from the front of the range, returns false if the range is empty.
+    bool take(uint32_t num, uint32_t &begin, uint32_t &end)
+    {
+      uint64_t r = range.load(memory_order_acquire);
+
+      while (true)
+      {
+        uint32_t b = unpack_begin(r);
+        uint32_t e = unpack_end(r);
+
+        if (b == e)
+        {
+          return false;
+        }
+
+        uint32_t n = (num < e - b) ? num : e - b;
+
+        if (range.compare_exchange_weak(r, pack(b + n, e), memory_order_acq_rel, memory_order_acquire))
+        {
+          begin = b;
+          end   = b + n;
+
+          return true;
+        }
+      }
+    }
+
+    // Thief side. Takes the back half of the range (all of it if only one task is left), returns false if the range is
+    // empty.
+    bool steal(uint32_t &begin, uint32_t &end)
+    {
+      uint64_t r = range.load(memory_order_acquire);
+
+      while (true)
+      {
+        uint32_t b = unpack_begin(r);
+        uint32_t e = unpack_end(r);
+
+        if (b == e)
+        {
+          return false;
+        }
+
+        uint32_t mid = b + (e - b) / 2;
+
+        if (range.compare_exchange_weak(r, pack(b, mid), memory_order_acq_rel, memory_order_acquire))
+        {
+          begin = mid;
+          end   = e;
+
+          return true;
+        }
+      }
+    }
+
+  private:
+    static uint64_t pack(uint32_t begin, uint32_t end) { return ((uint64_t) begin << 32) | end; }
+
+    static uint32_t unpack_begin(uint64_t r) { return (uint32_t) (r >> 32); }
+    static uint32_t unpack_end(uint64_t r)   { return (uint32_t) r; }
+
+    atomic<uint64_t> range;
+};
+
+#endif // RANGE_DEQUE_HPP
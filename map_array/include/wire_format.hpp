@@ -0,0 +1,218 @@
+#ifndef WIRE_FORMAT_HPP
+#define WIRE_FORMAT_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Binary format of the messages between the controller and applications. Each message is one frame, which starts with
+ * a wire_header giving the frame's length, version and type, followed by a body laid out for its type. A body is a run
+ * of 32 bit fields, where each array follows the field holding its length, so lists of pinnings or threads take only
+ * as many bytes as they have entries. Everything is little endian.
+ *
+ * The format itself only limits frames to 4GB, but each transport has its own cap. ZMQ carries frames of any size,
+ * while the shared memory transport carries frames of up to SHM_SLOT_BYTES (4KB), so at most 1018 pinnings, or
+ * telemetry from 339 threads. Larger frames are logged and not sent, see shm_frame in comms.hpp.
+ *
+ * Frames are read in place, out of the ZMQ message or buffer they arrived in. A wire_reader checks every field against
+ * the length of the frame before reading it, and arrays are handed back as views into the frame rather than copied.
+ *
+ * New fields are only ever added to the end of a body, and readers ignore anything past the fields they know, so
+ * older applications and controllers keep working. Readers skip types they do not know. Only changes that older
+ * readers could not skip bump WIRE_VERSION, and frames of any other version are rejected rather than misread.
+ */
+
+#define WIRE_VERSION 1
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "The wire format is little endian");
+
+
+
+// Start of every frame.
+struct wire_header {
+    // Bytes in the whole frame, this header included.
+    uint32_t length;
+
+    uint16_t version;
+    uint16_t type;
+
+    // Process the frame is from, or for.
+    uint32_t pid;
+};
+
+
+
+// Read only view of count elements of type T inside a frame. Elements are copied out as they are read, so the frame
+// needs no particular alignment.
+template <typename T>
+class wire_array {
+public:
+    wire_array(const char *data = NULL, uint32_t count = 0) : data(data), count(count) {}
+
+    uint32_t size() const {
+
+        return count;
+    }
+
+    T operator[](uint32_t i) const {
+
+        T value;
+        memcpy(&value, data + (size_t) i * sizeof(T), sizeof(T));
+
+        return value;
+    }
+
+private:
+    const char *data;
+    uint32_t count;
+};
+
+
+
+// Reads the body of a received frame in place, one field at a time. Once any read runs past the end of the frame the
+// reader fails, and every later read fails too.
+class wire_reader {
+public:
+    // Checks the header of the size bytes at data, which must outlive the reader and any array read from it.
+    wire_reader(const void *data, size_t size) : data(static_cast<const char*>(data)), size(size),
+                                                 offset(sizeof(wire_header)), ok(false) {
+
+        memset(&header, 0, sizeof(header));
+
+        if (data != NULL && size >= sizeof(wire_header)) {
+            memcpy(&header, data, sizeof(header));
+
+            ok = header.length == size && header.version == WIRE_VERSION;
+        }
+    }
+
+    // Whether the frame is whole, of our version, and every read so far fitted in it.
+    bool valid() const {
+
+        return ok;
+    }
+
+    // Type of the frame, or 0 if it is not valid.
+    uint16_t type() const {
+
+        return ok ? header.type : 0;
+    }
+
+    uint32_t pid() const {
+
+        return header.pid;
+    }
+
+    // Reads the next field.
+    template <typename T>
+    bool read(T &out) {
+
+        static_assert(sizeof(T) % 4 == 0, "Fields are whole 32 bit words");
+
+        if (!fits(sizeof(T))) {
+            return false;
+        }
+
+        memcpy(&out, data + offset, sizeof(T));
+        offset += sizeof(T);
+
+        return true;
+    }
+
+    // Reads a 32 bit length, then a view of that many elements following it.
+    template <typename T>
+    bool read_array(wire_array<T> &out) {
+
+        static_assert(sizeof(T) % 4 == 0, "Array elements are whole 32 bit words");
+
+        uint32_t count;
+
+        if (!read(count) || !fits((size_t) count * sizeof(T))) {
+            return false;
+        }
+
+        out = wire_array<T>(data + offset, count);
+        offset += (size_t) count * sizeof(T);
+
+        return true;
+    }
+
+private:
+    // Checks the next bytes bytes are in the frame, failing the reader if not.
+    bool fits(size_t bytes) {
+
+        ok = ok && bytes <= size - offset;
+
+        return ok;
+    }
+
+    const char *data;
+    size_t size;
+    size_t offset;
+
+    wire_header header;
+    bool ok;
+};
+
+
+
+// Writes a frame into a buffer of the given capacity. With a NULL buffer nothing is written, and the writer only counts
+// the bytes the frame needs, so that senders can size a buffer first.
+class wire_writer {
+public:
+    wire_writer(void *data, size_t capacity) : data(static_cast<char*>(data)), capacity(capacity),
+                                               offset(sizeof(wire_header)) {}
+
+    // Writes the next field.
+    template <typename T>
+    void write(const T &value) {
+
+        static_assert(sizeof(T) % 4 == 0, "Fields are whole 32 bit words");
+
+        put(&value, sizeof(T));
+    }
+
+    // Writes a 32 bit length, then that many elements from begin, each converted to T.
+    template <typename T, typename It>
+    void write_array(It begin, uint32_t count) {
+
+        write(count);
+
+        for (uint32_t i = 0; i < count; i++, ++begin) {
+            write((T) *begin);
+        }
+    }
+
+    // Writes the header, once the body is complete. Returns the size of the frame, or 0 if it did not fit in the buffer.
+    size_t finish(uint16_t type, uint32_t pid) {
+
+        if (offset > UINT32_MAX || (data != NULL && offset > capacity)) {
+            return 0;
+        }
+
+        if (data != NULL) {
+            wire_header header = {(uint32_t) offset, WIRE_VERSION, type, pid};
+
+            memcpy(data, &header, sizeof(header));
+        }
+
+        return offset;
+    }
+
+private:
+    void put(const void *value, size_t bytes) {
+
+        if (data != NULL && offset + bytes <= capacity) {
+            memcpy(data + offset, value, bytes);
+        }
+
+        offset += bytes;
+    }
+
+    char *data;
+    size_t capacity;
+    size_t offset;
+};
+
+#endif // WIRE_FORMAT_HPP
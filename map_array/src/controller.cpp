@@ -1,11 +1,18 @@
 #include <string>
 #include <iostream>
+#include <deque>
+#include <vector>
+#include <algorithm>
 
+#include <errno.h>
+#include <signal.h>
 #include <unistd.h>
+#include <sys/wait.h>
 
 #include <boost/thread.hpp> // boost::thread::hardware_concurrency();
 
 #include <comms.hpp>
+#include <numa_utils.hpp>
 
 using namespace std;
 using namespace zmq;
@@ -36,11 +43,16 @@ void message_printout(Message_type type, struct message mess) {
     cout << "   With schedule:       " << Schedules[mess.settings.schedule] << endl;
     cout << "   And thread pinnings: ";
 
-    uint32_t i_w = 0;
+    for (int cpu : mess.settings.thread_pinnings) {
+        cout << cpu << ' ';
+    }
+
+    if (!mess.settings.task_size_distribution.empty()) {
+        cout << endl << "   Task sizes:          ";
 
-    while (mess.settings.thread_pinnings[i_w] != -1) {
-        cout << mess.settings.thread_pinnings[i_w] << ' ';
-        i_w++;
+        for (uint32_t weight : mess.settings.task_size_distribution) {
+            cout << weight << ' ';
+        }
     }
 
     cout << endl << endl;
@@ -92,53 +104,432 @@ static int exec_prog(const char **args)
 
 
 
-int main () {
-    //  Prepare our context and socket
-    context_t context (1);
-    socket_t  socket (context, ZMQ_PAIR);
+// A live application, and where to reach it.
+struct app_record {
+    uint32_t pid;
+
+    // Slot of the application with the shared memory transport, or its identity with ZMQ.
+    uint32_t shm_slot;
+    string zmq_identity;
+
+    // Number of threads and schedule the application asked for when it registered.
+    uint32_t requested_threads;
+    Schedule requested_schedule;
+
+    // Number of threads worth giving the application, at most requested_threads. Lowered while its threads spend too 
+    // much of their time getting tasks rather than running them.
+    uint32_t useful_threads;
+
+    // Settings last sent to the application. No pinnings until it has been sent its first.
+    struct settings current;
+
+    // Threads and time of the last telemetry report received, if any, and when useful_threads last changed, in the 
+    // application's time.
+    bool has_report;
+    vector<struct thread_telemetry> last_threads;
+    uint32_t last_elapsed_micros;
+    uint32_t last_change_micros;
+};
+
+
+
+// Fraction of its threads' time an application spends running tasks, below which it is given one thread fewer, and 
+// above which it is given one back.
+#define SHRINK_EFFICIENCY 0.5
+#define GROW_EFFICIENCY   0.9
+
+// Minimum time between changes to the threads of one application, in microseconds, so that each change has been 
+// measured before the next.
+#define SETTLE_MICROS 100000
+
+// Longest the controller waits for a message before looking for applications which have died, in microseconds. Dead 
+// applications hold on to their shared memory slots until then, so new applications may find none free.
+#define SWEEP_MICROS 1000000
+
+
+
+Transport transport = Shm_transport;
+
+context_t context (1);
+socket_t  router (context, ZMQ_ROUTER);
+
+ShmControllerChannel channel;
+
+// Live applications, in order of registration.
+deque<app_record> registry;
+
+// Cores to share out between applications, grouped by NUMA node.
+deque<int> cores;
+
+
+
+// Send a message struct to the given application, over whichever transport we use.
+bool send_to_app(const app_record &app, const struct message &to_send) {
+
+    if (transport == Shm_transport) {
+        return m_send(channel, app.shm_slot, to_send);
+    }
+
+    return m_send(router, app.zmq_identity, to_send);
+}
+
+
+
+// Returns the live application with the given PID, or NULL if there is none.
+app_record *find_app(uint32_t pid) {
+
+    for (auto& app : registry) {
+        if (app.pid == pid) {
+            return &app;
+        }
+    }
+
+    return NULL;
+}
+
+
+
+// Drops applications whose process has gone away without telling us, and frees their shared memory slots. Returns 
+// the number of applications dropped.
+uint32_t drop_dead_apps() {
+
+    uint32_t dropped = 0;
+
+    for (auto it = registry.begin(); it != registry.end(); ) {
+        if (kill(it->pid, 0) == -1 && errno == ESRCH) {
+            cout << "PID: " << it->pid << " has gone away" << endl << endl;
+
+            it = registry.erase(it);
+
+            dropped++;
+
+        } else {
+            ++it;
+        }
+    }
+
+    // Including slots of applications which died before they registered.
+    if (transport == Shm_transport) {
+        uint32_t freed = channel.release_dead();
+
+        if (freed > 0) {
+            cout << "Freed " << freed << " slots of exited applications" << endl << endl;
+        }
+    }
+
+    return dropped;
+}
+
+
+
+/*
+ * Shares the cores out between the live applications, and sends new settings to each application whose share has 
+ * changed. Cores are dealt out one at a time, round robin in order of registration, to each application which still 
+ * wants more threads, so every application gets an equal share unless it asked for fewer threads. Each application 
+ * then takes its share as one run of the cores, which are grouped by NUMA node, so no two applications share a core, 
+ * and each stays on as few nodes, and so as few caches and memory controllers, as it can. Only when there are more 
+ * applications than cores do applications share cores. Those get one core each, and a dynamic schedule, so that 
+ * threads slowed down by a neighbour do not hold up the rest. Applications which measured poorly on their last share 
+ * are dealt fewer cores, see assess_progress.
+ */
+void repartition() {
+
+    drop_dead_apps();
+
+    uint32_t num_apps = registry.size();
+
+    if (num_apps == 0) {
+        return;
+    }
+
+    deque<uint32_t> shares(num_apps, 0);
+
+    uint32_t dealt = 0;
+    bool     dealing = true;
+
+    while (dealt < cores.size() && dealing) {
+        dealing = false;
+
+        for (uint32_t a = 0; a < num_apps && dealt < cores.size(); a++) {
+            if (shares.at(a) < registry.at(a).useful_threads) {
+                shares.at(a)++;
+                dealt++;
 
-    socket.bind("tcp://*:5555");
+                dealing = true;
+            }
+        }
+    }
+
+    uint32_t next_core = 0;
+
+    for (uint32_t a = 0; a < num_apps; a++) {
+        app_record &app = registry.at(a);
+
+        struct settings next;
+
+        next.schedule = app.requested_schedule;
+
+        if (shares.at(a) > 0) {
+            for (uint32_t t = 0; t < shares.at(a); t++) {
+                next.thread_pinnings.push_back(cores.at(next_core++));
+            }
+
+        } else {
+            // Out of cores, so double up.
+            next.thread_pinnings.push_back(cores.at(a % cores.size()));
+
+            next.schedule = Dynamic_chunks;
+        }
+
+        bool is_new = app.current.thread_pinnings.empty();
+
+        if (!is_new && next == app.current) {
+            continue;
+        }
+
+        struct message update;
+
+        update.header   = is_new ? CON_REP : CON_UPDT;
+        update.pid      = app.pid;
+        update.settings = next;
+
+        if (send_to_app(app, update)) {
+            app.current = next;
+
+            message_printout(Sending, update);
+
+        } else {
+            cout << "Cannot reach PID: " << app.pid << endl << endl;
+        }
+    }
+
+    cout << "Live applications: " << num_apps << endl << endl;
+}
+
+
+
+/*
+ * Measures an application's progress since its last telemetry report, and adjusts the number of threads worth giving 
+ * it. Applications whose threads spend most of their time getting tasks, or waiting on each other for them, gain 
+ * little from their last threads, so are given one fewer, freeing a core for the others. Once they run efficiently 
+ * again they are given it back, up to the number they asked for. Applications about to finish are left alone, as any 
+ * change would reach them too late to pay off. Returns true if the number of useful threads changed.
+ */
+bool assess_progress(app_record &app, const struct telemetry_view &report) {
+
+    bool had_report = app.has_report;
+
+    // Counters wrap, so only their differences mean anything.
+    uint32_t interval = report.elapsed_micros - app.last_elapsed_micros;
+
+    uint64_t tasks = 0, work = 0, overhead = 0;
+
+    for (uint32_t t = 0; t < report.threads.size(); t++) {
+        struct thread_telemetry now    = report.threads[t];
+        struct thread_telemetry before = {0, 0, 0};
+
+        if (t < app.last_threads.size()) {
+            before = app.last_threads[t];
+        }
+
+        tasks    += (uint32_t) (now.tasks_done - before.tasks_done);
+        work     += (uint32_t) (now.work_micros - before.work_micros);
+        overhead += (uint32_t) (now.overhead_micros - before.overhead_micros);
+    }
+
+    app.has_report          = true;
+    app.last_elapsed_micros = report.elapsed_micros;
+
+    app.last_threads.resize(report.threads.size());
+
+    for (uint32_t t = 0; t < report.threads.size(); t++) {
+        app.last_threads[t] = report.threads[t];
+    }
+
+    if (!had_report) {
+        app.last_change_micros = report.elapsed_micros;
+
+        return false;
+    }
+
+    if (interval == 0 || tasks == 0 || work + overhead == 0 || 
+        report.elapsed_micros - app.last_change_micros < SETTLE_MICROS) {
+        return false;
+    }
+
+    // Done before our next look, at this rate.
+    if (report.tasks_remaining < tasks) {
+        return false;
+    }
+
+    double efficiency = (double) work / (work + overhead);
+    double throughput = (double) tasks * 1000000 / interval;
+
+    uint32_t useful = app.useful_threads;
+
+    if (efficiency < SHRINK_EFFICIENCY && useful > 1) {
+        useful--;
+
+    } else if (efficiency > GROW_EFFICIENCY && useful < app.requested_threads) {
+        useful++;
+    }
+
+    if (useful == app.useful_threads) {
+        return false;
+    }
+
+    cout << "PID: " << app.pid << " ran " << (uint64_t) throughput << " tasks/s at " << (uint32_t) (efficiency * 100) 
+         << "% efficiency, with " << report.tasks_remaining << " tasks left" << endl;
+    cout << "   Useful threads:      " << app.useful_threads << " -> " << useful << endl << endl;
+
+    app.useful_threads     = useful;
+    app.last_change_micros = report.elapsed_micros;
+
+    return true;
+}
+
+
+
+// Usage: controller [shm|zmq] [num_cores]. Applications must use the same transport, shared memory by default. 
+// Applications can come and go while the controller runs, and the first num_cores cores (all of them by default) are 
+// shared out again whenever they do.
+int main (int argc, char *argv[]) {
+
+    uint32_t num_cores = boost::thread::hardware_concurrency();
+
+    if (argc > 1) {
+        if (string(argv[1]) == "zmq") {
+            transport = Zmq_transport;
+
+        } else if (string(argv[1]) != "shm") {
+            cout << "usage: controller [shm|zmq] [num_cores]" << endl;
+
+            return 1;
+        }
+    }
+
+    if (argc > 2) {
+        num_cores = max(atoi(argv[2]), 1);
+    }
+
+    if (transport == Shm_transport) {
+        if (!channel.bind()) {
+            perror("Cannot create " SHM_CONTROL_NAME);
+
+            return 1;
+        }
+
+    } else {
+        router.bind("tcp://*:" + to_string(DEFAULT_PORT));
+    }
+
+    // Group the cores by NUMA node, so runs of them stay on one node where they can.
+    for (uint32_t i = 0; i < num_cores; i++) {
+        cores.push_back(i);
+    }
+
+    stable_sort(cores.begin(), cores.end(), [] (int a, int b) { return numa_node_of(a) < numa_node_of(b); });
 
     while (true) {
 
-        // Wait for next message from client
-        struct message data = m_recv(socket);
+        // Wait for next message from client, and note where it came from
+        app_record from;
+
+        from.shm_slot = 0;
+
+        alignas(8) static char shm_frame[SHM_SLOT_BYTES];
+        message_t zmq_frame;
+
+        wire_reader received = transport == Shm_transport ? 
+                               f_recv(channel, from.shm_slot, shm_frame, sizeof(shm_frame), SWEEP_MICROS) : 
+                               f_recv(router, from.zmq_identity, zmq_frame);
+
+        struct message data;
+
+        // Nothing arrived in time, or nothing we could read, so look for applications which have died instead.
+        if (transport == Shm_transport && !received.valid()) {
+            if (drop_dead_apps() > 0) {
+                repartition();
+            }
+
+            continue;
+        }
 
-        switch (data.header) {
+        // Frames which are cut short, of another version, or of a type we do not know are skipped.
+        switch (received.type()) {
             case APP_REG:
                 {
+                    if (!wire_decode(received, data)) {
+                        break;
+                    }
+
                     message_printout(Receving, data);
-                        
-                    struct message rep;
 
-                    rep.header            = CON_REP;
-                    rep.pid               = data.pid;
-                    rep.settings.schedule = Static;
+                    from.pid                = data.pid;
+                    from.requested_schedule = data.settings.schedule;
+                    from.requested_threads  = max<uint32_t>(data.settings.thread_pinnings.size(), 1);
+                    from.useful_threads     = from.requested_threads;
+                    from.has_report         = false;
 
-                    fill_n(rep.settings.thread_pinnings, MAX_NUM_THREADS, -1);
+                    // A process registers again for each map_array call.
+                    registry.erase(remove_if(registry.begin(), registry.end(), 
+                                             [&data] (const app_record &app) { return app.pid == data.pid; }), 
+                                   registry.end());
 
-                    for (uint32_t i = 0; i < 4; i++)
-                    {
-                        rep.settings.thread_pinnings[i] = i;
-                    }
+                    registry.push_back(from);
 
-                    // Send reply to client.
-                    m_send(socket, rep);
+                    // Slots from its earlier calls are finished with, even if their APP_TERM was lost.
+                    for (uint32_t slot = 0; transport == Shm_transport && slot < SHM_MAX_APPS; slot++) {
+                        if (slot != from.shm_slot && channel.owner(slot) == data.pid) {
+                            channel.release(slot, data.pid);
+                        }
+                    }
 
-                    message_printout(Sending, rep);
+                    repartition();
 
                     break;
                 }
 
             case APP_TERM:
                 {
+                    if (!wire_decode(received, data)) {
+                        break;
+                    }
+
                     cout << "PID: " << data.pid << " terminated" << endl << endl;
 
-                    // Remove application from active list.
+                    // Its APP_TERM is the last thing it sends, so its slot can go to the next application.
+                    if (transport == Shm_transport) {
+                        channel.release(from.shm_slot, data.pid);
+                    }
+
+                    // Remove application from active list, and give its cores to the others.
+                    registry.erase(remove_if(registry.begin(), registry.end(), 
+                                             [&data] (const app_record &app) { return app.pid == data.pid; }), 
+                                   registry.end());
+
+                    repartition();
+
+                    break;
+                }
+
+            case APP_TELEM:
+                {
+                    struct telemetry_view report;
+
+                    if (!wire_decode(received, report)) {
+                        break;
+                    }
+
+                    app_record *app = find_app(report.pid);
+
+                    if (app != NULL && assess_progress(*app, report)) {
+                        repartition();
+                    }
 
                     break;
                 }
         }
     }
     return 0;
-}
\ No newline at end of file
+}
@@ -48,6 +48,9 @@ void printExperimentParameters(deque<eParameters> exParamsVector)
         print(exParamsVector[i].output_filename, ":\n",
               "\n\tNumber of threads: ", exParamsVector[i].params.thread_pinnings.size(),
               "\n\tTask distribution: ", exParamsVector[i].params.task_dist,
+              "\n\tNUMA aware:        ", exParamsVector[i].params.numa_aware,
+              "\n\tMain as worker:    ", exParamsVector[i].params.main_as_worker,
+              "\n\tTransport:         ", exParamsVector[i].params.transport == Shm_transport ? "shm" : "zmq",
               "\n\tSchedule:          ");
 
         if (exParamsVector[i].params.schedule == 0) 
@@ -70,6 +73,61 @@ void printExperimentParameters(deque<eParameters> exParamsVector)
         {
             print("Auto\n\n\n");
         }
+        else if (exParamsVector[i].params.schedule == 5)
+        {
+            print("Dynamic_atomic\n\n\n");
+        }
+    }
+}
+
+
+
+/*
+ * Reads the optional map_array settings in the given section of the config file into params, taking any the section 
+ * does not set from fallback. Keys are:
+ *
+ *     autoOverhead    - Overhead the Auto schedule aims for, as a fraction of time spent on tasks.
+ *     numaAware       - true to place each thread's data on its NUMA node.
+ *     mainAsWorker    - true to run thread 0 on the main thread.
+ *     transport       - shm or zmq, to reach the controller.
+ *     telemetryPeriod - Microseconds between telemetry reports to the controller, 0 for none.
+ */
+
+void readOptionalParams(boost::property_tree::ptree &propTree, string section, const parameters &fallback, 
+                        parameters &params)
+{
+    namespace pt = boost::property_tree;
+
+    // Path to the given key in our section.
+    auto path = [&section] (string key) { return pt::ptree::path_type(section + "/" + key, '/'); };
+
+    boost::optional<double>   overhead = propTree.get_optional<double>(path("autoOverhead"));
+    boost::optional<bool>     numa     = propTree.get_optional<bool>(path("numaAware"));
+    boost::optional<bool>     main_wkr = propTree.get_optional<bool>(path("mainAsWorker"));
+    boost::optional<string>   trans    = propTree.get_optional<string>(path("transport"));
+    boost::optional<uint32_t> period   = propTree.get_optional<uint32_t>(path("telemetryPeriod"));
+
+    params.auto_overhead    = overhead ? *overhead : fallback.auto_overhead;
+    params.numa_aware       = numa     ? *numa     : fallback.numa_aware;
+    params.main_as_worker   = main_wkr ? *main_wkr : fallback.main_as_worker;
+    params.telemetry_period = period   ? *period   : fallback.telemetry_period;
+    params.transport        = fallback.transport;
+
+    if (trans)
+    {
+        if (trans->compare("shm") == 0)
+        {
+            params.transport = Shm_transport;
+        }
+        else if (trans->compare("zmq") == 0)
+        {
+            params.transport = Zmq_transport;
+        }
+        else
+        {
+            print("\nUnrecognised transport: ", *trans, "\n\n");
+            exit(EXIT_FAILURE);
+        }
     }
 }
 
@@ -138,12 +196,18 @@ deque<eParameters> processConfig(char *argv[])
     {
         defaultParams.params.schedule = Auto;
     }
+    else if (sched.compare("Dynamic_atomic") == 0)
+    {
+        defaultParams.params.schedule = Dynamic_atomic;
+    }
     else
     {
         print("\nUnrecognised default schedule: ", sched, "\n\n");
         exit(EXIT_FAILURE);
     }
 
+    readOptionalParams(propTree, "DEFAULTS", parameters(), defaultParams.params);
+
 
 
     /*
@@ -216,6 +280,18 @@ deque<eParameters> processConfig(char *argv[])
             {
                 current.params.schedule = Dynamic_individual;
             }
+            else if (sched.compare("Tapered") == 0)
+            {
+                current.params.schedule = Tapered;
+            }
+            else if (sched.compare("Auto") == 0)
+            {
+                current.params.schedule = Auto;
+            }
+            else if (sched.compare("Dynamic_atomic") == 0)
+            {
+                current.params.schedule = Dynamic_atomic;
+            }
             else
             {
                 print("\nUnrecognised default schedule: ", sched, "\n\n");
@@ -236,6 +312,8 @@ deque<eParameters> processConfig(char *argv[])
             current.array_size = defaultParams.array_size;
         }
 
+        readOptionalParams(propTree, to_string(i + 1), defaultParams.params, current.params);
+
         // For however many repeats we want;
         for (uint32_t r = 0; r < repeats; r++) 
         {
@@ -166,6 +166,7 @@ Def:
 						break;
 
 					case Dynamic_chunks:
+					case Dynamic_atomic:
 						omp_set_schedule(omp_sched_dynamic, work.params.initial_chunk_size);
 
 						break;
@@ -12,7 +12,7 @@
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/xml_parser.hpp>
 
-#define NUM_SCHEDULES 4
+#define NUM_SCHEDULES 5
 #define NUM_USER_FUNCTIONS 1
 #define NUM_THREADING_LIBRARIES 4
 
@@ -23,9 +23,9 @@
  */
 
 // Possible schedules.
-enum Schedule {Static = 0, Dynamic_chunks = 1, Tapered = 2, Auto = 3};
+enum Schedule {Static = 0, Dynamic_chunks = 1, Tapered = 2, Auto = 3, Dynamic_atomic = 4};
 
-const std::string schedules[NUM_SCHEDULES] = {"Static", "Dynamic_chunks", "Tapered", "Auto"};
+const std::string schedules[NUM_SCHEDULES] = {"Static", "Dynamic_chunks", "Tapered", "Auto", "Dynamic_atomic"};
 
 // User functions.
 enum User_function {Collatz = 0};
@@ -0,0 +1,23 @@
+#ifndef NUMA_UTILS_HPP
+#define NUMA_UTILS_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * NUMA topology and memory placement helpers. The topology is read once from /sys/devices/system/node, and memory is
+ * placed with mbind. On machines without NUMA support every cpu is reported on node 0, and placement does nothing.
+ */
+
+// Returns the number of NUMA nodes in the system, at least 1.
+uint32_t numa_num_nodes();
+
+// Returns the NUMA node the given cpu belongs to, or 0 if it is unknown.
+int numa_node_of(int cpu);
+
+// Places the pages of [addr, addr + len) on the given node, migrating any which already live elsewhere. Pages which
+// have not been touched yet will be allocated there when first touched. Only whole pages inside the range are moved,
+// so neighbouring ranges never fight over a shared page. Returns false if the pages could not be placed.
+bool numa_place(const void *addr, size_t len, int node);
+
+#endif // NUMA_UTILS_HPP
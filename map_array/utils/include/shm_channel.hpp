@@ -0,0 +1,158 @@
+#ifndef SHM_CHANNEL_HPP
+#define SHM_CHANNEL_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+
+/*
+ * Shared memory transport between the controller and the applications on the same machine. The controller creates
+ * one segment under /dev/shm, holding a slot for each application. Each slot has a ring of messages in each direction,
+ * each ring having one producer and one consumer, so sending or receiving is a copy and a couple of atomic operations.
+ * Receivers with nothing to read sleep on a futex in the segment, and senders only make the wake system call when
+ * someone is asleep. The futexes are shared between processes, so unlike eventfds they need no file descriptors
+ * passing between them.
+ *
+ * Applications claim a slot by writing their pid into it, and only the controller frees slots, once their application
+ * has terminated or exited, so slots held by applications which crashed are not lost.
+ */
+
+// Name of the controller's segment, under /dev/shm.
+#define SHM_CONTROL_NAME "/map_array_control"
+
+// Maximum number of applications connected at once.
+#define SHM_MAX_APPS 64
+
+// Number of messages each ring holds.
+#define SHM_RING_SLOTS 8
+
+// Largest message a ring slot holds, in bytes.
+#define SHM_SLOT_BYTES 4096
+
+// Size of a cache line, used to keep words written by different processes from sharing lines.
+#define SHM_CACHE_LINE 64
+
+
+
+// Futex word bumped on every message sent to one receiver, and the number of waiters which may be asleep on it.
+struct shm_doorbell {
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint32_t> sleepers;
+
+    char padding[SHM_CACHE_LINE - 2 * sizeof(std::atomic<uint32_t>)];
+};
+
+// Single producer, single consumer ring of messages.
+struct shm_ring {
+    // Number of messages read, written by the consumer only.
+    std::atomic<uint32_t> head;
+    char head_padding[SHM_CACHE_LINE - sizeof(std::atomic<uint32_t>)];
+
+    // Number of messages written, written by the producer only.
+    std::atomic<uint32_t> tail;
+    char tail_padding[SHM_CACHE_LINE - sizeof(std::atomic<uint32_t>)];
+
+    struct slot {
+        uint32_t size;
+        char data[SHM_SLOT_BYTES];
+    } slots[SHM_RING_SLOTS];
+};
+
+// Per application part of the segment.
+struct shm_app {
+    // Pid of the application holding the slot, or 0 if it is free.
+    std::atomic<uint32_t> owner;
+    char padding[SHM_CACHE_LINE - sizeof(std::atomic<uint32_t>)];
+
+    // Rung by the controller when it sends to this application.
+    shm_doorbell doorbell;
+
+    shm_ring to_controller, to_app;
+};
+
+// Layout of the whole segment.
+struct shm_control {
+    // Set once the controller has initialised the segment.
+    std::atomic<uint32_t> ready;
+    char padding[SHM_CACHE_LINE - sizeof(std::atomic<uint32_t>)];
+
+    // Rung by every application when it sends to the controller.
+    shm_doorbell doorbell;
+
+    shm_app apps[SHM_MAX_APPS];
+};
+
+
+
+// Application end of the shared memory transport.
+class ShmAppChannel {
+public:
+    ShmAppChannel();
+
+    // Unmaps the segment, if mapped.
+    ~ShmAppChannel();
+
+    // Maps the controller's segment and claims a free slot in it. Returns false if there is no controller running, or
+    // no free slot.
+    bool connect();
+
+    // Unmaps the segment. The slot stays ours until the controller frees it, see ShmControllerChannel::release.
+    void close();
+
+    // Sends size bytes of data to the controller. Returns false if not connected, or if the ring is full.
+    bool send(const void *data, size_t size);
+
+    // Copies the next message from the controller into data, which holds up to size bytes, waiting up to timeout_us
+    // for one to arrive (0 never waits, negative waits forever). Returns the message size, or 0 if none arrived, or if
+    // wake was called.
+    size_t recv(void *data, size_t size, int64_t timeout_us);
+
+    // Makes the current recv return, or the next one if none is waiting. Safe to call from any thread of the process.
+    void wake();
+
+private:
+    shm_control *control;
+    shm_app *app;
+
+    // Set by wake, until a recv sees it.
+    std::atomic<bool> woken;
+};
+
+// Controller end of the shared memory transport.
+class ShmControllerChannel {
+public:
+    ShmControllerChannel();
+
+    // Unmaps and removes the segment, if we created it.
+    ~ShmControllerChannel();
+
+    // Creates and maps the segment, replacing any left behind by an earlier controller. Returns false on failure.
+    bool bind();
+
+    // Sends size bytes of data to the application in the given slot. Returns false if the ring is full.
+    bool send(uint32_t app_id, const void *data, size_t size);
+
+    // Copies the next message from any application into data, which holds up to size bytes, waiting up to timeout_us
+    // for one to arrive (0 never waits, negative waits forever). Writes the sender's slot to app_id. Returns the message
+    // size, or 0 if none arrived.
+    size_t recv(uint32_t &app_id, void *data, size_t size, int64_t timeout_us);
+
+    // Returns the pid of the application holding the given slot, or 0 if it is free.
+    uint32_t owner(uint32_t app_id) const;
+
+    // Frees the given slot, if it is held by pid, dropping anything left in its rings. Only call once the application
+    // has finished with the slot.
+    void release(uint32_t app_id, uint32_t pid);
+
+    // Frees every slot held by an application which has exited. Returns the number of slots freed.
+    uint32_t release_dead();
+
+private:
+    shm_control *control;
+
+    // Slot to look at first on the next receive, so that no application can starve the others.
+    uint32_t next_app;
+};
+
+#endif // SHM_CHANNEL_HPP
@@ -0,0 +1,87 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+
+
+
+/*
+ * A persistent pool of pinned worker threads, which outlives individual map_array calls. Idle workers spin briefly and
+ * then park on a futex, so dispatching work costs no thread creation, and at most one wake-up system call per worker.
+ * Workers are only re-pinned when asked to run on a different cpu, and are never joined until the program exits.
+ */
+
+// Function run by a pool worker. Same signature as a pthread start routine.
+typedef void *(*pool_job)(void *);
+
+class ThreadPool {
+public:
+    ThreadPool();
+
+    // Stops and joins every worker.
+    ~ThreadPool();
+
+    // Runs job(arg) on the given worker, first pinning it to the given cpu if it isn't already (a negative cpu leaves
+    // the pinning unchanged). Creates workers up to worker_id if they do not exist yet. The worker must be idle.
+    void dispatch(uint32_t worker_id, int cpu, pool_job job, void *arg);
+
+    // Blocks until every dispatched job has returned.
+    void wait();
+
+    // Blocks until the given worker's job has returned.
+    void wait(uint32_t worker_id);
+
+    // Returns the number of workers created so far.
+    uint32_t size();
+
+private:
+    // Worker states.
+    enum Worker_state : uint32_t {Idle = 0, Sleeping = 1, Busy = 2, Stop = 3};
+
+    // Per worker data. Padded so that neighbouring workers' states never share a cache line.
+    struct worker {
+        std::atomic<uint32_t> state;
+
+        // Bumped each time the worker finishes a job, and the number of threads in wait(worker_id) which may be asleep
+        // on it.
+        std::atomic<uint32_t> jobs_done;
+        std::atomic<uint32_t> waiters;
+
+        pool_job job;
+        void *arg;
+
+        // Cpu requested by the last dispatch, and cpu the worker is currently pinned to.
+        int cpu;
+        int pinned_cpu;
+
+        ThreadPool *pool;
+        pthread_t thread;
+
+        char padding[64];
+    };
+
+    // Main loop of each worker thread.
+    static void *worker_loop(void *arg);
+
+    friend void pin_this_worker(int cpu);
+
+    // Number of dispatched jobs which have not yet returned.
+    std::atomic<uint32_t> active;
+
+    std::deque<std::unique_ptr<worker>> workers;
+};
+
+
+
+// Returns the process wide pool used by map_array.
+ThreadPool& get_thread_pool();
+
+// Re-pins the calling pool worker from inside a running job, keeping the pool's record of its pinning up to date.
+void pin_this_worker(int cpu);
+
+#endif // THREAD_POOL_HPP
@@ -0,0 +1,161 @@
+#include "numa_utils.hpp"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <numaif.h>
+
+#include <vector>
+
+
+
+// Location of the NUMA topology in sysfs.
+#define NUMA_SYSFS_NODES "/sys/devices/system/node"
+
+
+
+// Cached topology, read once on first use.
+struct numa_topology {
+    uint32_t num_nodes = 1;
+
+    // Node of each cpu, indexed by cpu number.
+    std::vector<int> cpu_nodes;
+};
+
+// Marks each cpu in a sysfs cpu list, such as "0-3,8-11", as belonging to node.
+static void parse_cpu_list(const char *list, int node, std::vector<int> &cpu_nodes) {
+
+    const char *p = list;
+
+    while (*p != '\0' && *p != '\n') {
+        char *end;
+
+        long first = strtol(p, &end, 10);
+        long last  = first;
+
+        if (end == p) {
+            break;
+        }
+
+        if (*end == '-') {
+            p    = end + 1;
+            last = strtol(p, &end, 10);
+        }
+
+        for (long cpu = first; cpu <= last; cpu++) {
+            if ((size_t) cpu >= cpu_nodes.size()) {
+                cpu_nodes.resize(cpu + 1, 0);
+            }
+
+            cpu_nodes.at(cpu) = node;
+        }
+
+        p = (*end == ',') ? end + 1 : end;
+    }
+}
+
+// Reads the topology from sysfs.
+static numa_topology read_topology() {
+
+    numa_topology topology;
+
+    DIR *dir = opendir(NUMA_SYSFS_NODES);
+
+    if (dir == NULL) {
+        return topology;
+    }
+
+    uint32_t max_node = 0;
+
+    while (struct dirent *entry = readdir(dir)) {
+        int node;
+
+        if (sscanf(entry->d_name, "node%d", &node) != 1) {
+            continue;
+        }
+
+        char path[512];
+        snprintf(path, sizeof(path), NUMA_SYSFS_NODES "/%s/cpulist", entry->d_name);
+
+        FILE *file = fopen(path, "r");
+
+        if (file == NULL) {
+            continue;
+        }
+
+        char list[4096];
+
+        if (fgets(list, sizeof(list), file) != NULL) {
+            parse_cpu_list(list, node, topology.cpu_nodes);
+        }
+
+        fclose(file);
+
+        if ((uint32_t) node > max_node) {
+            max_node = node;
+        }
+    }
+
+    closedir(dir);
+
+    topology.num_nodes = max_node + 1;
+
+    return topology;
+}
+
+// Returns the cached topology.
+static const numa_topology& get_topology() {
+
+    static numa_topology topology = read_topology();
+
+    return topology;
+}
+
+
+
+// Returns the number of NUMA nodes in the system, at least 1.
+uint32_t numa_num_nodes() {
+
+    return get_topology().num_nodes;
+}
+
+// Returns the NUMA node the given cpu belongs to, or 0 if it is unknown.
+int numa_node_of(int cpu) {
+
+    const numa_topology &topology = get_topology();
+
+    if (cpu < 0 || (size_t) cpu >= topology.cpu_nodes.size()) {
+        return 0;
+    }
+
+    return topology.cpu_nodes.at(cpu);
+}
+
+// Places the pages of [addr, addr + len) on the given node, migrating any which already live elsewhere. Only whole
+// pages inside the range are moved, so neighbouring ranges never fight over a shared page.
+bool numa_place(const void *addr, size_t len, int node) {
+
+    if (numa_num_nodes() < 2 || node < 0) {
+        return true;
+    }
+
+    static uintptr_t page_size = sysconf(_SC_PAGESIZE);
+
+    uintptr_t begin = ((uintptr_t) addr + page_size - 1) & ~(page_size - 1);
+    uintptr_t end   = ((uintptr_t) addr + len) & ~(page_size - 1);
+
+    if (end <= begin) {
+        return true;
+    }
+
+    std::vector<unsigned long> node_mask(node / (8 * sizeof(unsigned long)) + 1, 0);
+
+    node_mask.at(node / (8 * sizeof(unsigned long))) |= 1UL << (node % (8 * sizeof(unsigned long)));
+
+    // Preferred rather than bound, so an allocation still succeeds if the node runs out of memory.
+    long rc = mbind((void *) begin, end - begin, MPOL_PREFERRED, node_mask.data(), 8 * sizeof(unsigned long) *
+                    node_mask.size() + 1, MPOL_MF_MOVE);
+
+    return rc == 0;
+}
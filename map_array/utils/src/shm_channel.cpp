@@ -0,0 +1,388 @@
+#include "shm_channel.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+
+#include "utils.hpp"
+
+
+
+// Sleeps while the futex word at addr holds the expected value, for at most timeout (forever if NULL). The word lives
+// in memory shared between processes, so the private futex operations cannot be used.
+static void futex_wait(std::atomic<uint32_t> *addr, uint32_t expected, const struct timespec *timeout) {
+
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT, expected, timeout, NULL, 0);
+}
+
+// Wakes every process sleeping on the futex word at addr.
+static void futex_wake(std::atomic<uint32_t> *addr) {
+
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Returns the monotonic clock in microseconds.
+static int64_t now_us() {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+
+// Copies size bytes of data into the next free slot of the ring. Only ever called by the ring's producer. Returns
+// false if the ring is full, or the message empty or too large for a slot.
+static bool ring_push(shm_ring &ring, const void *data, size_t size) {
+
+    uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+
+    if (size == 0 || size > SHM_SLOT_BYTES || tail - ring.head.load(std::memory_order_acquire) == SHM_RING_SLOTS) {
+        return false;
+    }
+
+    shm_ring::slot &slot = ring.slots[tail % SHM_RING_SLOTS];
+
+    slot.size = size;
+    memcpy(slot.data, data, size);
+
+    ring.tail.store(tail + 1, std::memory_order_release);
+
+    return true;
+}
+
+// Copies the oldest message in the ring into data, truncating it to size bytes. Only ever called by the ring's
+// consumer. Returns the size of the message, or 0 if the ring is empty.
+static size_t ring_pop(shm_ring &ring, void *data, size_t size) {
+
+    uint32_t head = ring.head.load(std::memory_order_relaxed);
+
+    if (head == ring.tail.load(std::memory_order_acquire)) {
+        return 0;
+    }
+
+    shm_ring::slot &slot = ring.slots[head % SHM_RING_SLOTS];
+
+    size_t message_size = slot.size;
+    memcpy(data, slot.data, std::min(message_size, size));
+
+    ring.head.store(head + 1, std::memory_order_release);
+
+    return message_size;
+}
+
+// Tells the receiver behind the doorbell that a message has been sent, waking it if it may be asleep.
+static void ring_doorbell(shm_doorbell &doorbell) {
+
+    doorbell.sequence.fetch_add(1);
+
+    if (doorbell.sleepers.load() != 0) {
+        futex_wake(&doorbell.sequence);
+    }
+}
+
+// Sleeps on the doorbell while its sequence is still the one read before the receiver last found nothing to read, or
+// until the deadline passes (never, if negative). Returns false once the deadline has passed.
+static bool wait_doorbell(shm_doorbell &doorbell, uint32_t sequence, int64_t deadline) {
+
+    struct timespec timeout;
+    struct timespec *timeout_ptr = NULL;
+
+    if (deadline >= 0) {
+        int64_t remaining = deadline - now_us();
+
+        if (remaining <= 0) {
+            return false;
+        }
+
+        timeout.tv_sec  = remaining / 1000000;
+        timeout.tv_nsec = (remaining % 1000000) * 1000;
+        timeout_ptr     = &timeout;
+    }
+
+    doorbell.sleepers.fetch_add(1);
+
+    futex_wait(&doorbell.sequence, sequence, timeout_ptr);
+
+    doorbell.sleepers.fetch_sub(1);
+
+    return true;
+}
+
+
+
+ShmAppChannel::ShmAppChannel() : control(NULL), app(NULL), woken(false) {}
+
+ShmAppChannel::~ShmAppChannel() {
+
+    close();
+}
+
+// Maps the controller's segment and claims a free slot in it. Returns false if there is no controller running, or no
+// free slot.
+bool ShmAppChannel::connect() {
+
+    close();
+
+    int fd = shm_open(SHM_CONTROL_NAME, O_RDWR, 0);
+
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(shm_control)) {
+        ::close(fd);
+
+        return false;
+    }
+
+    void *addr = mmap(NULL, sizeof(shm_control), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    ::close(fd);
+
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    control = static_cast<shm_control*>(addr);
+
+    if (control->ready.load() == 0) {
+        close();
+
+        return false;
+    }
+
+    uint32_t pid = getpid();
+
+    // The controller empties both rings before freeing a slot, so a free slot is ready to use.
+    for (uint32_t i = 0; i < SHM_MAX_APPS; i++) {
+        uint32_t expected = 0;
+
+        if (control->apps[i].owner.compare_exchange_strong(expected, pid)) {
+            app = &control->apps[i];
+
+            return true;
+        }
+    }
+
+    print("[Shm] No free application slots\n");
+
+    close();
+
+    return false;
+}
+
+// Unmaps the segment. The slot stays ours until the controller frees it.
+void ShmAppChannel::close() {
+
+    app = NULL;
+
+    if (control != NULL) {
+        munmap(control, sizeof(shm_control));
+        control = NULL;
+    }
+}
+
+// Sends size bytes of data to the controller. Returns false if not connected, or if the ring is full.
+bool ShmAppChannel::send(const void *data, size_t size) {
+
+    if (app == NULL || !ring_push(app->to_controller, data, size)) {
+        return false;
+    }
+
+    ring_doorbell(control->doorbell);
+
+    return true;
+}
+
+// Copies the next message from the controller into data, waiting up to timeout_us for one to arrive. Returns the
+// message size, or 0 if none arrived, or if wake was called.
+size_t ShmAppChannel::recv(void *data, size_t size, int64_t timeout_us) {
+
+    if (app == NULL) {
+        return 0;
+    }
+
+    int64_t deadline = timeout_us < 0 ? -1 : now_us() + timeout_us;
+
+    while (true) {
+        uint32_t sequence = app->doorbell.sequence.load();
+
+        // Checked after reading the sequence, so a wake between here and the futex wait still stops us sleeping.
+        if (woken.exchange(false)) {
+            return 0;
+        }
+
+        size_t received = ring_pop(app->to_app, data, size);
+
+        if (received != 0 || timeout_us == 0 || !wait_doorbell(app->doorbell, sequence, deadline)) {
+            return received;
+        }
+    }
+}
+
+
+// Makes the current recv return, or the next one if none is waiting.
+void ShmAppChannel::wake() {
+
+    if (app == NULL) {
+        return;
+    }
+
+    woken.store(true);
+
+    ring_doorbell(app->doorbell);
+}
+
+
+
+ShmControllerChannel::ShmControllerChannel() : control(NULL), next_app(0) {}
+
+ShmControllerChannel::~ShmControllerChannel() {
+
+    if (control != NULL) {
+        munmap(control, sizeof(shm_control));
+        shm_unlink(SHM_CONTROL_NAME);
+    }
+}
+
+// Creates and maps the segment, replacing any left behind by an earlier controller. Returns false on failure.
+bool ShmControllerChannel::bind() {
+
+    // Applications still attached to an old segment keep their mapping, but are no longer reachable.
+    shm_unlink(SHM_CONTROL_NAME);
+
+    int fd = shm_open(SHM_CONTROL_NAME, O_RDWR | O_CREAT | O_EXCL, 0666);
+
+    if (fd == -1) {
+        return false;
+    }
+
+    // A new segment reads as zeros, which is a valid empty state for every ring and doorbell.
+    if (ftruncate(fd, sizeof(shm_control)) == -1) {
+        ::close(fd);
+        shm_unlink(SHM_CONTROL_NAME);
+
+        return false;
+    }
+
+    void *addr = mmap(NULL, sizeof(shm_control), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    ::close(fd);
+
+    if (addr == MAP_FAILED) {
+        shm_unlink(SHM_CONTROL_NAME);
+
+        return false;
+    }
+
+    control = static_cast<shm_control*>(addr);
+    control->ready.store(1);
+
+    return true;
+}
+
+// Sends size bytes of data to the application in the given slot. Returns false if the ring is full.
+bool ShmControllerChannel::send(uint32_t app_id, const void *data, size_t size) {
+
+    if (control == NULL || app_id >= SHM_MAX_APPS || !ring_push(control->apps[app_id].to_app, data, size)) {
+        return false;
+    }
+
+    ring_doorbell(control->apps[app_id].doorbell);
+
+    return true;
+}
+
+// Copies the next message from any application into data, waiting up to timeout_us for one to arrive. Writes the
+// sender's slot to app_id. Returns the message size, or 0 if none arrived.
+size_t ShmControllerChannel::recv(uint32_t &app_id, void *data, size_t size, int64_t timeout_us) {
+
+    if (control == NULL) {
+        return 0;
+    }
+
+    int64_t deadline = timeout_us < 0 ? -1 : now_us() + timeout_us;
+
+    while (true) {
+        uint32_t sequence = control->doorbell.sequence.load();
+
+        for (uint32_t i = 0; i < SHM_MAX_APPS; i++) {
+            uint32_t a = (next_app + i) % SHM_MAX_APPS;
+
+            size_t received = ring_pop(control->apps[a].to_controller, data, size);
+
+            if (received != 0) {
+                app_id   = a;
+                next_app = (a + 1) % SHM_MAX_APPS;
+
+                return received;
+            }
+        }
+
+        if (timeout_us == 0 || !wait_doorbell(control->doorbell, sequence, deadline)) {
+            return 0;
+        }
+    }
+}
+
+// Returns the pid of the application holding the given slot, or 0 if it is free.
+uint32_t ShmControllerChannel::owner(uint32_t app_id) const {
+
+    if (control == NULL || app_id >= SHM_MAX_APPS) {
+        return 0;
+    }
+
+    return control->apps[app_id].owner.load();
+}
+
+// Frees the given slot, if it is held by pid, dropping anything left in its rings.
+void ShmControllerChannel::release(uint32_t app_id, uint32_t pid) {
+
+    if (pid == 0 || owner(app_id) != pid) {
+        return;
+    }
+
+    shm_app &slot = control->apps[app_id];
+
+    // We consume to_controller and produce to_app, and the application is done with both, so both can be emptied.
+    slot.to_controller.head.store(slot.to_controller.tail.load());
+    slot.to_app.head.store(slot.to_app.tail.load());
+
+    // An application killed while asleep never took itself off the count.
+    slot.doorbell.sleepers.store(0);
+
+    // Last, so the next owner finds the slot empty.
+    slot.owner.store(0);
+}
+
+// Frees every slot held by an application which has exited. Returns the number of slots freed.
+uint32_t ShmControllerChannel::release_dead() {
+
+    uint32_t freed = 0;
+
+    for (uint32_t i = 0; i < SHM_MAX_APPS; i++) {
+        uint32_t pid = owner(i);
+
+        if (pid != 0 && kill(pid, 0) == -1 && errno == ESRCH) {
+            release(i, pid);
+
+            freed++;
+        }
+    }
+
+    return freed;
+}
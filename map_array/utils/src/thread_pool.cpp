@@ -0,0 +1,245 @@
+#include "thread_pool.hpp"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "utils.hpp"
+
+
+
+// Number of times an idle worker, or a waiting dispatcher, checks for a change before sleeping on the futex.
+#define POOL_SPIN_COUNT 4096
+
+
+
+// Worker record of the calling thread, if it is a pool worker.
+static thread_local void *current_worker = NULL;
+
+
+
+// Tells the cpu we are spinning, so it can save power and give way to the other hyperthread on the core.
+static inline void cpu_relax() {
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#else
+    asm volatile("" ::: "memory");
+#endif
+}
+
+// Sleeps while the futex word at addr holds the expected value.
+static void futex_wait(std::atomic<uint32_t> *addr, uint32_t expected) {
+
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+// Wakes up to num_waiters threads sleeping on the futex word at addr.
+static void futex_wake(std::atomic<uint32_t> *addr, int num_waiters) {
+
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, num_waiters, NULL, NULL, 0);
+}
+
+
+
+ThreadPool::ThreadPool() : active(0) {}
+
+// Stops and joins every worker.
+ThreadPool::~ThreadPool() {
+
+    for (auto& w : workers) {
+        if (w->state.exchange(Stop) == Sleeping) {
+            futex_wake(&w->state, 1);
+        }
+    }
+
+    for (auto& w : workers) {
+        pthread_join(w->thread, NULL);
+    }
+}
+
+// Runs job(arg) on the given worker, first pinning it to the given cpu if it isn't already. Creates workers up to
+// worker_id if they do not exist yet. The worker must be idle.
+void ThreadPool::dispatch(uint32_t worker_id, int cpu, pool_job job, void *arg) {
+
+    // Create any missing workers, which start out idle.
+    while (workers.size() <= worker_id) {
+        std::unique_ptr<worker> w(new worker());
+
+        w->state      = Idle;
+        w->jobs_done  = 0;
+        w->waiters    = 0;
+        w->cpu        = -1;
+        w->pinned_cpu = -1;
+        w->pool       = this;
+
+        int rc = pthread_create(&w->thread, NULL, worker_loop, (void *) w.get());
+
+        if (rc) {
+            // If we couldn't create a new thread, throw an error and exit.
+            print("[Pool] ERROR; return code from pthread_create() is ", rc, "\n");
+            exit(-1);
+        }
+
+        // Set thread name to something recognizable.
+        char thread_name[16];
+        sprintf(thread_name, "MA Thread %u", (uint32_t) workers.size());
+
+        pthread_setname_np(w->thread, thread_name);
+
+        workers.push_back(std::move(w));
+    }
+
+    worker *w = workers.at(worker_id).get();
+
+    w->job = job;
+    w->arg = arg;
+    w->cpu = cpu;
+
+    active.fetch_add(1);
+
+    // Publish the job, waking the worker if it has gone to sleep.
+    if (w->state.exchange(Busy) == Sleeping) {
+        futex_wake(&w->state, 1);
+    }
+}
+
+// Blocks until every dispatched job has returned.
+void ThreadPool::wait() {
+
+    for (uint32_t i = 0; i < POOL_SPIN_COUNT && active.load() != 0; i++) {
+        cpu_relax();
+    }
+
+    uint32_t a;
+
+    while ((a = active.load()) != 0) {
+        futex_wait(&active, a);
+    }
+}
+
+// Blocks until the given worker's job has returned.
+void ThreadPool::wait(uint32_t worker_id) {
+
+    if (worker_id >= workers.size()) {
+        return;
+    }
+
+    worker *w = workers.at(worker_id).get();
+
+    for (uint32_t i = 0; i < POOL_SPIN_COUNT && w->state.load() == Busy; i++) {
+        cpu_relax();
+    }
+
+    while (true) {
+        uint32_t done = w->jobs_done.load();
+
+        if (w->state.load() != Busy) {
+            return;
+        }
+
+        // Announce ourselves before checking again, so the worker either sees us and wakes us, or we see it finish.
+        w->waiters.fetch_add(1);
+
+        if (w->state.load() == Busy) {
+            futex_wait(&w->jobs_done, done);
+        }
+
+        w->waiters.fetch_sub(1);
+    }
+}
+
+// Returns the number of workers created so far.
+uint32_t ThreadPool::size() {
+
+    return workers.size();
+}
+
+// Main loop of each worker thread.
+void *ThreadPool::worker_loop(void *arg) {
+
+    worker *w = (worker *) arg;
+
+    current_worker = w;
+
+    while (true) {
+        uint32_t s = w->state.load();
+
+        // Spin for a while in case more work arrives straight away.
+        for (uint32_t i = 0; i < POOL_SPIN_COUNT && s == Idle; i++) {
+            cpu_relax();
+
+            s = w->state.load();
+        }
+
+        // Then announce that we are sleeping, and park until woken.
+        while (s == Idle || s == Sleeping) {
+            if (s == Idle && !w->state.compare_exchange_strong(s, Sleeping)) {
+                continue;
+            }
+
+            futex_wait(&w->state, Sleeping);
+
+            s = w->state.load();
+        }
+
+        if (s == Stop) {
+            break;
+        }
+
+        // Only re-pin when asked to move.
+        if (w->cpu >= 0 && w->cpu != w->pinned_cpu) {
+            stick_this_thread_to_cpu(w->cpu);
+
+            w->pinned_cpu = w->cpu;
+        }
+
+        w->job(w->arg);
+
+        // Go back to idle, unless the pool has told us to stop while the job ran.
+        uint32_t busy = Busy;
+
+        w->state.compare_exchange_strong(busy, Idle);
+
+        // Wake anyone waiting on this worker alone, only making the system call if they may be asleep.
+        w->jobs_done.fetch_add(1);
+
+        if (w->waiters.load() != 0) {
+            futex_wake(&w->jobs_done, INT_MAX);
+        }
+
+        // Wake the dispatcher once the last job has finished.
+        if (w->pool->active.fetch_sub(1) == 1) {
+            futex_wake(&w->pool->active, INT_MAX);
+        }
+    }
+
+    return NULL;
+}
+
+
+
+// Returns the process wide pool used by map_array.
+ThreadPool& get_thread_pool() {
+
+    static ThreadPool pool;
+
+    return pool;
+}
+
+// Re-pins the calling pool worker from inside a running job, keeping the pool's record of its pinning up to date.
+void pin_this_worker(int cpu) {
+
+    ThreadPool::worker *w = (ThreadPool::worker *) current_worker;
+
+    stick_this_thread_to_cpu(cpu);
+
+    if (w != NULL) {
+        w->pinned_cpu = cpu;
+    }
+}